@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <string_view>
+
+import evk;
+
+[[noreturn]] void exitWithError(const std::string_view error = "") {
+    if (error.empty()) std::printf("%s\n", error.data());
+    exit(EXIT_FAILURE);
+}
+
+// create/destroy throughput of many small buffers, sub-allocated vs one vkAllocateMemory per buffer
+int main(int /*argc*/, char** /*argv*/)
+{
+    // Instance Setup
+    std::vector<const char*> iExtensions{};
+    if (evk::isApple) iExtensions.emplace_back(vk::KHRPortabilityEnumerationExtensionName);
+
+    const auto& ctx = evk::context();
+    evk::utils::remExtsOrLayersIfNotAvailable(iExtensions, ctx.enumerateInstanceExtensionProperties(), [](const char* e) { std::printf("Extension removed because not available: %s\n", e); });
+
+    vk::InstanceCreateFlags instanceFlags = {};
+    if constexpr (evk::isApple) instanceFlags = vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR;
+    auto instance = evk::Instance::shared(ctx, instanceFlags, vk::ApplicationInfo{ nullptr, 0, nullptr, 0, vk::ApiVersion13 }, std::vector<const char*>{}, iExtensions);
+
+    // Device setup
+    const vk::raii::PhysicalDevices physicalDevices{ instance };
+    const vk::raii::PhysicalDevice& physicalDevice{ physicalDevices[0] };
+    std::printf("Device: %s\n", physicalDevice.getProperties().deviceName.data());
+    const auto queueFamilyIndex = evk::utils::findQueueFamilyIndex(physicalDevice.getQueueFamilyProperties(), vk::QueueFlagBits::eCompute);
+    if (!queueFamilyIndex.has_value()) exitWithError("No queue family index found");
+    std::vector<const char*> dExtensions{};
+    if constexpr (evk::isApple) dExtensions.emplace_back("VK_KHR_portability_subset");
+    dExtensions.emplace_back(vk::EXTMemoryBudgetExtensionName);
+    evk::utils::remExtsOrLayersIfNotAvailable(dExtensions, physicalDevice.enumerateDeviceExtensionProperties(), [](const char* e) { std::printf("Extension removed because not available: %s\n", e); });
+
+    auto vulkan12Features = vk::PhysicalDeviceVulkan12Features{}.setBufferDeviceAddress(true);
+    vk::PhysicalDeviceFeatures2 physicalDeviceFeatures2{ {}, &vulkan12Features };
+    auto device = evk::make_shared<evk::Device>(instance, physicalDevice, dExtensions, evk::Device::Queues{ { queueFamilyIndex.value(), 1 } }, &physicalDeviceFeatures2);
+
+    // the dedicated path is bounded by maxMemoryAllocationCount (often 4096), leave some room for the driver
+    constexpr uint32_t requestedCount = 20000u;
+    const uint32_t dedicatedCount = std::min(requestedCount, device->properties.limits.maxMemoryAllocationCount - 256u);
+    constexpr vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress;
+
+    const auto run = [&](const bool dedicated, const uint32_t count) {
+        std::vector<evk::Buffer> buffers;
+        buffers.reserve(count);
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            const vk::DeviceSize size = 256u << (i % 8u); // 256B - 32KiB
+            buffers.emplace_back(device, size, usage, vk::MemoryPropertyFlagBits::eDeviceLocal, false, dedicated);
+        }
+        const auto t1 = std::chrono::high_resolution_clock::now();
+        buffers.clear();
+        const auto t2 = std::chrono::high_resolution_clock::now();
+
+        const double create = std::chrono::duration<double, std::micro>(t1 - t0).count();
+        const double destroy = std::chrono::duration<double, std::micro>(t2 - t1).count();
+        std::printf("%-14s %6u buffers | create %10.1f us (%7.3f us/buffer) | destroy %10.1f us (%7.3f us/buffer)\n",
+            dedicated ? "dedicated" : "sub-allocated", count, create, create / count, destroy, destroy / count);
+    };
+
+    run(true, dedicatedCount);
+    run(false, dedicatedCount);
+    run(false, requestedCount);
+
+    const auto stats = device->memoryStats();
+    for (size_t i = 0; i < stats.heaps.size(); i++) {
+        const auto& h = stats.heaps[i];
+        std::printf("heap %zu | budget %8.1f MiB | usage %8.1f MiB | evk blocks peak %8.1f MiB | allocations peak %8.1f MiB\n",
+            i, h.budget / 1048576.0, h.usage / 1048576.0, h.blocks.peak / 1048576.0, h.allocations.peak / 1048576.0);
+    }
+    return 0;
+}
@@ -88,9 +88,8 @@ int main(int /*argc*/, char** /*argv*/)
     };
     const size_t verticesSize = vertices.size() * sizeof(float);
     auto buffer = std::make_unique<evk::Buffer>(device, verticesSize, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible); /* reBAR */
-    void* p = buffer->memory.mapMemory(0, vk::WholeSize);
-    std::memcpy(p, vertices.data(), verticesSize);
-    buffer->memory.unmapMemory();
+    buffer->write(vertices.data(), verticesSize);
+    buffer->flush();
 
     // Acceleration structure setup
     evk::CommandPool commandPool{ device, queueFamilyIndex.value() };
@@ -111,9 +110,8 @@ int main(int /*argc*/, char** /*argv*/)
     size_t instanceBufferSize = instances.size() * sizeof(vk::AccelerationStructureInstanceKHR);
     auto instanceBuffer = evk::Buffer(device, instanceBufferSize, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal);
-    void* ptr = instanceBuffer.memory.mapMemory(0, instanceBufferSize);
-    std::memcpy(ptr, instances.data(), instanceBufferSize);
-    instanceBuffer.memory.unmapMemory();
+    instanceBuffer.write(instances.data(), instanceBufferSize);
+    instanceBuffer.flush();
 
     auto tlas = evk::rt::TopLevelAccelerationStructure{ device, instanceBuffer.deviceAddress, 1 };
     tlas.cmdBuild(stcb);
@@ -137,6 +135,7 @@ int main(int /*argc*/, char** /*argv*/)
     vk::ImageMemoryBarrier2 imageMemoryBarrier{};
     imageMemoryBarrier.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
     vk::DependencyInfo dependencyInfo = vk::DependencyInfo{}.setImageMemoryBarriers(imageMemoryBarrier);
+    evk::BarrierBatch barriers;
 
     // Target image setup
     std::vector<evk::Image> images;
@@ -190,12 +189,13 @@ int main(int /*argc*/, char** /*argv*/)
         imageMemoryBarrier.setOldLayout(vk::ImageLayout::eUndefined).setNewLayout(vk::ImageLayout::eTransferDstOptimal)
             .setSrcStageMask(vk::PipelineStageFlagBits2::eAllCommands).setSrcAccessMask({})
             .setDstStageMask(vk::PipelineStageFlagBits2::eTransfer).setDstAccessMask(vk::AccessFlagBits2::eTransferWrite);
-        cb.pipelineBarrier2(dependencyInfo);
+        barriers.add(imageMemoryBarrier);
         imageMemoryBarrier.image = src_image.image;
         imageMemoryBarrier.setOldLayout(vk::ImageLayout::eGeneral).setNewLayout(vk::ImageLayout::eGeneral)
             .setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader).setSrcAccessMask(vk::AccessFlagBits2::eMemoryWrite)
             .setDstStageMask(vk::PipelineStageFlagBits2::eTransfer).setDstAccessMask(vk::AccessFlagBits2::eTransferRead);
-        cb.pipelineBarrier2(dependencyInfo);
+        barriers.add(imageMemoryBarrier);
+        barriers.flush(cb);
 
         auto region = vk::ImageCopy2{}.setExtent(vk::Extent3D{ sCapabilities.currentExtent.width, sCapabilities.currentExtent.height, 1 })
             .setSrcSubresource({ vk::ImageAspectFlagBits::eColor, 0, 0, 1 })
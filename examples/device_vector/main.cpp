@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <string_view>
+
+import evk;
+
+[[noreturn]] void exitWithError(const std::string_view error = "") {
+    if (!error.empty()) std::printf("%s\n", error.data());
+    exit(EXIT_FAILURE);
+}
+
+// fills an evk::DeviceVector over many frames (growing the device buffer and wrapping its staging ring) and checks the contents
+// through a host cached readback buffer
+int main(int /*argc*/, char** /*argv*/)
+{
+    // Instance Setup
+    std::vector<const char*> iExtensions{};
+    if (evk::isApple) iExtensions.emplace_back(vk::KHRPortabilityEnumerationExtensionName);
+
+    std::vector<const char*> iLayers{};
+    if constexpr (evk::isDebug) iLayers.emplace_back("VK_LAYER_KHRONOS_validation");
+
+    const auto& ctx = evk::context();
+    evk::utils::remExtsOrLayersIfNotAvailable(iExtensions, ctx.enumerateInstanceExtensionProperties(), [](const char* e) { std::printf("Extension removed because not available: %s\n", e); });
+    evk::utils::remExtsOrLayersIfNotAvailable(iLayers, ctx.enumerateInstanceLayerProperties(), [](const char* e) { std::printf("Layer removed because not available: %s\n", e); });
+
+    vk::InstanceCreateFlags instanceFlags = {};
+    if constexpr (evk::isApple) instanceFlags = vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR;
+    auto instance = evk::Instance::shared(ctx, instanceFlags, vk::ApplicationInfo{ nullptr, 0, nullptr, 0, vk::ApiVersion13 }, iLayers, iExtensions);
+
+    // Device setup
+    const vk::raii::PhysicalDevices physicalDevices{ instance };
+    const vk::raii::PhysicalDevice& physicalDevice{ physicalDevices[0] };
+    const auto queueFamilyIndex = evk::utils::findQueueFamilyIndex(physicalDevice.getQueueFamilyProperties(), vk::QueueFlagBits::eCompute);
+    if (!queueFamilyIndex.has_value()) exitWithError("No queue family index found");
+    std::vector<const char*> dExtensions{};
+    if constexpr (evk::isApple) dExtensions.emplace_back("VK_KHR_portability_subset");
+
+    auto vulkan13Features = vk::PhysicalDeviceVulkan13Features{}.setSynchronization2(true);
+    auto vulkan12Features = vk::PhysicalDeviceVulkan12Features{}.setBufferDeviceAddress(true).setPNext(&vulkan13Features);
+    vk::PhysicalDeviceFeatures2 physicalDeviceFeatures2{ {}, &vulkan12Features };
+    auto device = evk::make_shared<evk::Device>(instance, physicalDevice, dExtensions, evk::Device::Queues{ { queueFamilyIndex.value(), 1 } }, &physicalDeviceFeatures2);
+    const auto& queue = device->getQueue(queueFamilyIndex.value(), 0);
+
+    evk::CommandPool commandPool{ device, queueFamilyIndex.value() };
+    auto cb = commandPool.allocateCommandBuffer();
+
+    evk::DeviceVector<uint32_t> values{ device, vk::BufferUsageFlagBits::eStorageBuffer, 0, "values" };
+    values.onAddressChanged.emplace_back([&values](const vk::DeviceAddress address) {
+        std::printf("grew to %zu elements at 0x%llx\n", values.capacity(), static_cast<unsigned long long>(address));
+    });
+
+    // every frame is retired before the next one starts, so the staging ring is reused instead of growing
+    uint32_t count = 0;
+    for (uint32_t frame = 0; frame < 64u; frame++) {
+        const auto frameId = values.beginFrame();
+        for (uint32_t i = 0; i < 1000u + frame * 100u; i++) values.push_back(count++);
+        cb.begin(vk::CommandBufferBeginInfo{});
+        values.cmdSync(cb);
+        cb.end();
+        queue.submitAndWaitIdle(vk::SubmitInfo{ {}, {}, *cb }, nullptr);
+        values.retire(frameId);
+    }
+    // shrinking forgets the synced tail, growing again uploads the new elements behind it
+    values.resize(count / 2u);
+    values.resize(count, 7u);
+
+    const vk::DeviceSize byteSize = values.size() * sizeof(uint32_t);
+    evk::Buffer readback{ device, byteSize, vk::BufferUsageFlagBits::eTransferDst, evk::utils::readbackMemory, false, false, "readback" };
+    cb.begin(vk::CommandBufferBeginInfo{});
+    values.cmdSync(cb);
+    cb.copyBuffer(*values.buffer.buffer, *readback.buffer, vk::BufferCopy{ 0, 0, byteSize });
+    cb.end();
+    queue.submitAndWaitIdle(vk::SubmitInfo{ {}, {}, *cb }, nullptr);
+    readback.invalidate();
+
+    const auto data = readback.data<uint32_t>();
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t expected = i < count / 2u ? i : 7u;
+        if (data[i] != expected) {
+            std::printf("values[%u] is %u instead of %u\n", i, data[i], expected);
+            exitWithError();
+        }
+    }
+    std::printf("%u values verified, readback memory type flags 0x%x\n", count, static_cast<uint32_t>(readback.memoryPropertyFlags));
+    return 0;
+}
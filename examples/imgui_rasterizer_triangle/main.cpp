@@ -91,9 +91,8 @@ int main(int /*argc*/, char** /*argv*/)
     };
     const size_t verticesSize = vertices.size() * sizeof(float);
     auto buffer = std::make_unique<evk::Buffer>(device, verticesSize, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible); /* reBAR */
-    void* p = buffer->memory.mapMemory(0, vk::WholeSize);
-    std::memcpy(p, vertices.data(), verticesSize);
-    buffer->memory.unmapMemory();
+    buffer->write(vertices.data(), verticesSize);
+    buffer->flush();
 
     // Shader object setup
     // https://github.com/KhronosGroup/Vulkan-Docs/blob/main/proposals/VK_EXT_shader_object.adoc
@@ -88,9 +88,8 @@ int main(int /*argc*/, char** /*argv*/)
     };
     const size_t verticesSize = vertices.size() * sizeof(float);
     auto buffer = std::make_unique<evk::Buffer>(device, verticesSize, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible); /* reBAR */
-    void* p = buffer->memory.mapMemory(0, vk::WholeSize);
-    std::memcpy(p, vertices.data(), verticesSize);
-    buffer->memory.unmapMemory();
+    buffer->write(vertices.data(), verticesSize);
+    buffer->flush();
 
     // Acceleration structure setup
     evk::CommandPool commandPool{ device, queueFamilyIndex.value() };
@@ -111,9 +110,8 @@ int main(int /*argc*/, char** /*argv*/)
     size_t instanceBufferSize = instances.size() * sizeof(vk::AccelerationStructureInstanceKHR);
     auto instanceBuffer = evk::Buffer(device, instanceBufferSize, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal);
-    void* ptr = instanceBuffer.memory.mapMemory(0, instanceBufferSize);
-    std::memcpy(ptr, instances.data(), instanceBufferSize);
-    instanceBuffer.memory.unmapMemory();
+    instanceBuffer.write(instances.data(), instanceBufferSize);
+    instanceBuffer.flush();
 
     auto tlas = evk::rt::TopLevelAccelerationStructure{ device, instanceBuffer.deviceAddress, 1 };
     tlas.cmdBuild(stcb);
@@ -0,0 +1,348 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <optional>
+#include <vector>
+#include <string_view>
+
+import evk;
+
+[[noreturn]] void exitWithError(const std::string_view error = "") {
+    if (!error.empty()) std::printf("%s\n", error.data());
+    exit(EXIT_FAILURE);
+}
+
+void memoryBarrier(const vk::raii::CommandBuffer& cb, const vk::PipelineStageFlags2 srcStage, const vk::AccessFlags2 srcAccess, const vk::PipelineStageFlags2 dstStage, const vk::AccessFlags2 dstAccess)
+{
+    const vk::MemoryBarrier2 barrier{ srcStage, srcAccess, dstStage, dstAccess };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(barrier));
+}
+
+// headless run of the frame, queue and streaming helpers, every part checks its results through one host cached readback buffer.
+// Sparse binding and the shared image ring are skipped when the device lacks the features/extensions they need
+int main(int /*argc*/, char** /*argv*/)
+{
+    // Instance Setup
+    std::vector<const char*> iExtensions{};
+    if (evk::isApple) iExtensions.emplace_back(vk::KHRPortabilityEnumerationExtensionName);
+
+    std::vector<const char*> iLayers{};
+    if constexpr (evk::isDebug) iLayers.emplace_back("VK_LAYER_KHRONOS_validation");
+
+    const auto& ctx = evk::context();
+    evk::utils::remExtsOrLayersIfNotAvailable(iExtensions, ctx.enumerateInstanceExtensionProperties(), [](const char* e) { std::printf("Extension removed because not available: %s\n", e); });
+    evk::utils::remExtsOrLayersIfNotAvailable(iLayers, ctx.enumerateInstanceLayerProperties(), [](const char* e) { std::printf("Layer removed because not available: %s\n", e); });
+
+    vk::InstanceCreateFlags instanceFlags = {};
+    if constexpr (evk::isApple) instanceFlags = vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR;
+    auto instance = evk::Instance::shared(ctx, instanceFlags, vk::ApplicationInfo{ nullptr, 0, nullptr, 0, vk::ApiVersion13 }, iLayers, iExtensions);
+
+    // Device setup
+    const vk::raii::PhysicalDevices physicalDevices{ instance };
+    const vk::raii::PhysicalDevice& physicalDevice{ physicalDevices[0] };
+    std::printf("Device: %s\n", physicalDevice.getProperties().deviceName.data());
+    const auto supported = physicalDevice.getFeatures();
+    const bool sparse = supported.sparseBinding && supported.sparseResidencyBuffer;
+    // * external memory and semaphores for the shared image ring
+    std::vector<const char*> dExtensions{};
+    if constexpr (evk::isApple) dExtensions.emplace_back("VK_KHR_portability_subset");
+    const std::vector<const char*> sharingExtensions = evk::isWindows ?
+        std::vector<const char*>{ vk::KHRExternalMemoryWin32ExtensionName, vk::KHRExternalSemaphoreWin32ExtensionName } :
+        std::vector<const char*>{ vk::KHRExternalMemoryFdExtensionName, vk::KHRExternalSemaphoreFdExtensionName };
+    const bool sharing = evk::utils::extensionsOrLayersAvailable(physicalDevice.enumerateDeviceExtensionProperties(), sharingExtensions);
+    if (sharing) dExtensions.insert(dExtensions.end(), sharingExtensions.begin(), sharingExtensions.end());
+
+    auto vulkan13Features = vk::PhysicalDeviceVulkan13Features{}.setSynchronization2(true);
+    auto vulkan12Features = vk::PhysicalDeviceVulkan12Features{}.setTimelineSemaphore(true).setBufferDeviceAddress(true).setPNext(&vulkan13Features);
+    vk::PhysicalDeviceFeatures2 physicalDeviceFeatures2{ {}, &vulkan12Features };
+    physicalDeviceFeatures2.features.sparseBinding = sparse;
+    physicalDeviceFeatures2.features.sparseResidencyBuffer = sparse;
+    physicalDeviceFeatures2.features.textureCompressionBC = supported.textureCompressionBC;
+    // * one queue of each role (graphics, async compute, transfer)
+    auto device = evk::make_shared<evk::Device>(instance, physicalDevice, dExtensions, evk::Device::Queues{}, &physicalDeviceFeatures2);
+    if (!device->graphicsFamily.has_value()) exitWithError("No graphics queue family found");
+    const evk::Device::QueueFamily graphics = device->graphicsFamily.value();
+    const evk::Device::QueueFamily compute = device->computeFamily.value_or(graphics);
+    const evk::Device::QueueFamily transfer = device->transferFamily.value_or(graphics);
+    const auto& graphicsQueue = device->getQueue(graphics);
+    evk::CommandPool graphicsPool{ device, graphics };
+
+    evk::Buffer readback{ device, 1u << 20u, vk::BufferUsageFlagBits::eTransferDst, evk::utils::readbackMemory, false, false, "readback" };
+    bool failed = false;
+    const auto check = [&failed](const bool ok, const char* what) {
+        std::printf("%-20s %s\n", what, ok ? "ok" : "FAILED");
+        failed |= !ok;
+    };
+
+    // TransientAllocator: one slice per frame, the ring is reused once the frame retired
+    {
+        evk::TransientAllocator transient{ device, 4096u, vk::BufferUsageFlagBits::eTransferSrc };
+        for (uint32_t frame = 0; frame < 64u; frame++) {
+            const auto frameId = transient.beginFrame();
+            const auto slice = transient.push(std::array{ frame, frame * 2u, frame * 3u, frame * 4u });
+            graphicsPool.submitImmediate(graphicsQueue, [&](const vk::raii::CommandBuffer& cb) {
+                cb.copyBuffer(slice.buffer, *readback.buffer, vk::BufferCopy{ slice.offset, frame * slice.size, slice.size });
+            });
+            transient.retire(frameId);
+        }
+        readback.invalidate();
+        const auto data = readback.data<uint32_t>();
+        bool ok = true;
+        for (uint32_t i = 0; i < 64u * 4u; i++) ok &= data[i] == (i / 4u) * (i % 4u + 1u);
+        check(ok, "TransientAllocator");
+    }
+
+    // UploadEngine and bc: a buffer and a BC7 mip chain uploaded on the transfer queue, acquired on the graphics queue
+    {
+        std::vector<uint32_t> values(4096);
+        std::iota(values.begin(), values.end(), 0u);
+        const vk::DeviceSize byteSize = values.size() * sizeof(uint32_t);
+        evk::Buffer buffer{ device, byteSize, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal };
+
+        constexpr uint32_t size = 64u;
+        std::vector<uint8_t> rgba(size * size * 4u);
+        for (uint32_t i = 0; i < rgba.size(); i++) rgba[i] = static_cast<uint8_t>((i / 4u % size) * 4u + (i % 4u) * 16u);
+        evk::utils::ThreadPool threads{ 4 };
+        const auto encoded = evk::bc::encodeMips(evk::bc::Codec::BC7, rgba.data(), size, size, 0, &threads);
+        const size_t mip0Size = evk::bc::encodedSize(evk::bc::Codec::BC7, size, size);
+        check(evk::bc::encode(evk::bc::Codec::BC7, rgba.data(), size, size).size() == mip0Size && encoded.size() > mip0Size, "bc::encode");
+
+        evk::UploadEngine uploads{ device, transfer, graphics };
+        uploads.upload(buffer, values.data(), byteSize);
+        std::optional<evk::Image> texture;
+        if (supported.textureCompressionBC) {
+            texture.emplace(device, vk::Extent3D{ size, size, 1 }, evk::bc::format(evk::bc::Codec::BC7), vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal, true, "bc7", 0u);
+            uploads.upload(*texture, encoded.data(), vk::ImageLayout::eTransferSrcOptimal);
+        }
+        const auto ticket = uploads.flush();
+
+        auto cb = graphicsPool.allocateCommandBuffer();
+        cb.begin(vk::CommandBufferBeginInfo{});
+        uploads.cmdAcquire(cb);
+        memoryBarrier(cb, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+        cb.copyBuffer(*buffer.buffer, *readback.buffer, vk::BufferCopy{ 0, 0, byteSize });
+        if (texture) {
+            cb.copyImageToBuffer(*texture->image, vk::ImageLayout::eTransferSrcOptimal, *readback.buffer,
+                vk::BufferImageCopy{ byteSize, 0, 0, { texture->aspectMask, 0, 0, 1 }, {}, texture->mipExtent(0) });
+        }
+        cb.end();
+        const auto wait = uploads.waitInfo(ticket, vk::PipelineStageFlagBits2::eAllCommands);
+        const vk::CommandBufferSubmitInfo commandBufferInfo{ *cb };
+        graphicsQueue.submit2AndWaitIdle(vk::SubmitInfo2{ {}, wait, commandBufferInfo }, nullptr);
+        check(uploads.isComplete(ticket), "UploadEngine ticket");
+
+        readback.invalidate();
+        const auto data = readback.data();
+        check(std::memcmp(data.data(), values.data(), byteSize) == 0, "UploadEngine");
+        if (texture) check(std::memcmp(data.data() + byteSize, encoded.data(), mip0Size) == 0, "UploadEngine bc7");
+        else std::printf("%-20s skipped, textureCompressionBC not supported\n", "UploadEngine bc7");
+    }
+
+    // OwnershipTransfer: written on the compute queue, read on the graphics queue
+    {
+        evk::Buffer buffer{ device, 1024u, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal };
+        evk::OwnershipTransfer handoff{ compute, graphics, vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite,
+            vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead };
+        handoff.add(buffer);
+        // waiting for the release before the acquire is submitted stands in for a semaphore between the queues
+        evk::CommandPool computePool{ device, compute };
+        computePool.submitImmediate(device->getQueue(compute), [&](const vk::raii::CommandBuffer& cb) {
+            cb.fillBuffer(*buffer.buffer, 0, vk::WholeSize, 0xC0FFEEu);
+            handoff.cmdRelease(cb);
+        });
+        graphicsPool.submitImmediate(graphicsQueue, [&](const vk::raii::CommandBuffer& cb) {
+            handoff.cmdAcquire(cb);
+            cb.copyBuffer(*buffer.buffer, *readback.buffer, vk::BufferCopy{ 0, 0, 1024u });
+        });
+        readback.invalidate();
+        const auto data = readback.data<uint32_t>();
+        check(std::all_of(data.begin(), data.begin() + 256, [](const uint32_t v) { return v == 0xC0FFEEu; }), "OwnershipTransfer");
+    }
+
+    // QueueSubmitter: many small submits handed to the submission thread, the last ticket covers all of them
+    {
+        constexpr uint32_t count = 64u;
+        evk::Buffer buffer{ device, count * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal };
+        evk::QueueSubmitter submitter{ device, graphics };
+        std::vector<vk::raii::CommandBuffer> commandBuffers;
+        evk::QueueSubmitter::Ticket ticket;
+        for (uint32_t i = 0; i <= count; i++) {
+            auto& cb = commandBuffers.emplace_back(graphicsPool.allocateCommandBuffer());
+            cb.begin(vk::CommandBufferBeginInfo{});
+            if (i < count) {
+                cb.fillBuffer(*buffer.buffer, i * sizeof(uint32_t), sizeof(uint32_t), i * 7u);
+            } else {
+                memoryBarrier(cb, vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+                cb.copyBuffer(*buffer.buffer, *readback.buffer, vk::BufferCopy{ 0, 0, buffer.size });
+            }
+            cb.end();
+            ticket = submitter.submit({ { vk::CommandBufferSubmitInfo{ *cb } } });
+        }
+        submitter.wait(ticket);
+        readback.invalidate();
+        const auto data = readback.data<uint32_t>();
+        bool ok = true;
+        for (uint32_t i = 0; i < count; i++) ok &= data[i] == i * 7u;
+        check(ok, "QueueSubmitter");
+    }
+
+    // ParallelRecorder: secondaries recorded on a thread pool, executed in order on one primary
+    {
+        constexpr uint32_t count = 256u;
+        evk::Buffer buffer{ device, count * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal };
+        evk::utils::ThreadPool threads{ 4 };
+        evk::ParallelRecorder recorder{ device, graphics };
+        for (uint32_t frame = 0; frame < 3u; frame++) {
+            const auto frameId = recorder.beginFrame();
+            recorder.record(threads, count, [&](const uint32_t i, const vk::raii::CommandBuffer& cb) {
+                cb.fillBuffer(*buffer.buffer, i * sizeof(uint32_t), sizeof(uint32_t), i + frame);
+            });
+            graphicsPool.submitImmediate(graphicsQueue, [&](const vk::raii::CommandBuffer& cb) {
+                recorder.cmdExecute(cb);
+                memoryBarrier(cb, vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+                cb.copyBuffer(*buffer.buffer, *readback.buffer, vk::BufferCopy{ 0, 0, buffer.size });
+            });
+            recorder.retire(frameId);
+        }
+        readback.invalidate();
+        const auto data = readback.data<uint32_t>();
+        bool ok = true;
+        for (uint32_t i = 0; i < count; i++) ok &= data[i] == i + 2u;
+        check(ok, "ParallelRecorder");
+    }
+
+    // ImagePool and RenderGraph: clear -> copy -> copy into an imported image -> readback, an unused pass is culled
+    {
+        constexpr vk::Extent3D extent{ 16, 16, 1 };
+        constexpr vk::Format format = vk::Format::eR8G8B8A8Unorm;
+        constexpr vk::ImageSubresourceRange range{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+        constexpr vk::ImageSubresourceLayers layers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+        const evk::ImagePool::Desc desc{ extent, format, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst };
+        evk::ImagePool imagePool{ device };
+        evk::Image output{ device, extent, format, vk::ImageTiling::eOptimal, vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal };
+
+        bool ok = true;
+        for (uint32_t frame = 0; frame < 3u; frame++) {
+            const auto frameId = imagePool.beginFrame();
+            evk::RenderGraph graph{ device, imagePool };
+            const auto result = graph.importImage(output, vk::ImageLayout::eTransferSrcOptimal);
+            const auto target = graph.importBuffer(readback);
+            const auto first = graph.createImage(desc);
+            const auto second = graph.createImage(desc);
+            const auto unused = graph.createImage(desc);
+            const vk::ClearColorValue color{ (frame + 1u) / 255.0f, 0.0f, 0.0f, 1.0f };
+
+            graph.addPass("clear", [&](const vk::raii::CommandBuffer& cb) {
+                cb.clearColorImage(graph.handle(first), vk::ImageLayout::eTransferDstOptimal, color, range);
+            }).write(first, vk::PipelineStageFlagBits2::eClear, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal);
+            graph.addPass("copy", [&](const vk::raii::CommandBuffer& cb) {
+                cb.copyImage(graph.handle(first), vk::ImageLayout::eTransferSrcOptimal, graph.handle(second), vk::ImageLayout::eTransferDstOptimal, vk::ImageCopy{ layers, {}, layers, {}, extent });
+            }).read(first, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+              .write(second, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal);
+            graph.addPass("resolve", [&](const vk::raii::CommandBuffer& cb) {
+                cb.copyImage(graph.handle(second), vk::ImageLayout::eTransferSrcOptimal, graph.handle(result), vk::ImageLayout::eTransferDstOptimal, vk::ImageCopy{ layers, {}, layers, {}, extent });
+            }).read(second, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+              .write(result, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal);
+            graph.addPass("unused", [&](const vk::raii::CommandBuffer& cb) {
+                cb.clearColorImage(graph.handle(unused), vk::ImageLayout::eTransferDstOptimal, color, range);
+            }).write(unused, vk::PipelineStageFlagBits2::eClear, vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal);
+            graph.addPass("readback", [&](const vk::raii::CommandBuffer& cb) {
+                cb.copyImageToBuffer(graph.handle(result), vk::ImageLayout::eTransferSrcOptimal, graph.buffer(target), vk::BufferImageCopy{ 0, 0, 0, layers, {}, extent });
+            }).read(result, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal)
+              .write(target, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite)
+              .sideEffects();
+
+            graphicsPool.submitImmediate(graphicsQueue, [&](const vk::raii::CommandBuffer& cb) { graph.execute(cb); });
+            imagePool.retire(frameId);
+            ok &= !graph.isCulled(0) && graph.isCulled(3) && output.barrier.oldLayout == vk::ImageLayout::eTransferSrcOptimal;
+            readback.invalidate();
+            const auto data = readback.data<uint8_t>();
+            for (uint32_t i = 0; i < extent.width * extent.height; i++) ok &= data[i * 4u] == frame + 1u && data[i * 4u + 3u] == 255u;
+        }
+        check(ok, "RenderGraph");
+
+        // an image is handed out again once its frame retired and nobody else holds it
+        const evk::Image* recycled = nullptr;
+        bool reused = true;
+        for (uint32_t frame = 0; frame < 3u; frame++) {
+            const auto frameId = imagePool.beginFrame();
+            const auto image = imagePool.acquire(desc);
+            if (recycled) reused &= image.get() == recycled;
+            recycled = image.get();
+            imagePool.retire(frameId);
+        }
+        imagePool.trim();
+        check(reused, "ImagePool");
+    }
+
+    // SparseBinder: one page of a sparse buffer bound, written, read back and unbound again
+    if (sparse && (physicalDevice.getQueueFamilyProperties()[graphics].queueFlags & vk::QueueFlagBits::eSparseBinding)) {
+        evk::SparseBuffer sparseBuffer{ device, 1u << 20u, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+            vk::MemoryPropertyFlagBits::eDeviceLocal, {}, true };
+        evk::SparseBinder binder{ device, graphics };
+        evk::SparseBuffer* const buffers[] = { &sparseBuffer };
+        const vk::DeviceSize page = sparseBuffer.pageSize;
+        sparseBuffer.bind(page, page);
+        check(binder.wait(binder.commit(buffers, {})) && sparseBuffer.residentPages() == 1u && sparseBuffer.isResident(1) && !sparseBuffer.isResident(0), "SparseBinder bind");
+
+        graphicsPool.submitImmediate(graphicsQueue, [&](const vk::raii::CommandBuffer& cb) {
+            cb.fillBuffer(*sparseBuffer.buffer, page, 1024u, 0x5EA15EAu);
+            memoryBarrier(cb, vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+            cb.copyBuffer(*sparseBuffer.buffer, *readback.buffer, vk::BufferCopy{ page, 0, 1024u });
+        });
+        readback.invalidate();
+        const auto data = readback.data<uint32_t>();
+        check(std::all_of(data.begin(), data.begin() + 256, [](const uint32_t v) { return v == 0x5EA15EAu; }), "SparseBuffer");
+
+        sparseBuffer.unbind(0, sparseBuffer.size);
+        check(binder.wait(binder.commit(buffers, {})) && sparseBuffer.residentPages() == 0u, "SparseBinder unbind");
+    } else {
+        std::printf("%-20s skipped, sparse residency not supported\n", "SparseBinder");
+    }
+
+    // SharedImageRing: producer and consumer opened in one process, frames of the producer are read by the consumer
+    if (sharing) {
+        constexpr vk::Extent3D extent{ 4, 4, 1 };
+        constexpr vk::Format format = vk::Format::eR8G8B8A8Unorm;
+        constexpr vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+        constexpr vk::ImageSubresourceRange range{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+        evk::SharedImageRing producer{ device, 2u, extent, format, usage };
+        evk::SharedImageRing consumer{ device, producer.exportHandles(), extent, format, usage };
+
+        bool ok = true;
+        auto cb = graphicsPool.allocateCommandBuffer();
+        for (uint32_t frame = 0; frame < 5u; frame++) {
+            const auto written = producer.next(vk::PipelineStageFlagBits2::eClear);
+            cb.begin(vk::CommandBufferBeginInfo{});
+            producer.cmdAcquire(cb, written, graphics, vk::ImageLayout::eTransferDstOptimal);
+            cb.clearColorImage(*written.image->image, vk::ImageLayout::eTransferDstOptimal, vk::ClearColorValue{ (frame + 1u) / 255.0f, 0.0f, 0.0f, 1.0f }, range);
+            producer.cmdRelease(cb, written, graphics, vk::ImageLayout::eTransferDstOptimal);
+            cb.end();
+            const vk::CommandBufferSubmitInfo produceInfo{ *cb };
+            graphicsQueue.submit2AndWaitIdle(vk::SubmitInfo2{ {}, written.wait, produceInfo, written.signal }, nullptr);
+
+            const auto read = consumer.next(vk::PipelineStageFlagBits2::eCopy);
+            cb.begin(vk::CommandBufferBeginInfo{});
+            consumer.cmdAcquire(cb, read, graphics, vk::ImageLayout::eTransferSrcOptimal);
+            cb.copyImageToBuffer(*read.image->image, vk::ImageLayout::eTransferSrcOptimal, *readback.buffer,
+                vk::BufferImageCopy{ 0, 0, 0, { vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, {}, extent });
+            consumer.cmdRelease(cb, read, graphics, vk::ImageLayout::eTransferSrcOptimal);
+            cb.end();
+            const vk::CommandBufferSubmitInfo consumeInfo{ *cb };
+            graphicsQueue.submit2AndWaitIdle(vk::SubmitInfo2{ {}, read.wait, consumeInfo, read.signal }, nullptr);
+
+            readback.invalidate();
+            ok &= read.index == written.index && readback.data<uint8_t>()[0] == frame + 1u;
+        }
+        check(ok && producer.produced->value() == 5u && producer.consumed->value() == 5u, "SharedImageRing");
+    } else {
+        std::printf("%-20s skipped, external memory/semaphore extensions not available\n", "SharedImageRing");
+    }
+
+    return failed ? EXIT_FAILURE : 0;
+}
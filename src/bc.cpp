@@ -0,0 +1,282 @@
+module;
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+module evk;
+import :bc;
+import :utils;
+using namespace evk;
+
+namespace
+{
+    using Block = std::array<std::array<uint8_t, 4>, 16>; // rgba of the 16 texels, row by row
+
+    Block fetch(const uint8_t* rgba, const uint32_t width, const uint32_t height, const uint32_t bx, const uint32_t by)
+    {
+        Block block;
+        for (uint32_t y = 0; y < 4u; y++) {
+            const uint32_t sy = std::min(by * 4u + y, height - 1u);
+            for (uint32_t x = 0; x < 4u; x++) {
+                const uint32_t sx = std::min(bx * 4u + x, width - 1u);
+                std::memcpy(block[y * 4u + x].data(), rgba + (static_cast<size_t>(sy) * width + sx) * 4u, 4u);
+            }
+        }
+        return block;
+    }
+
+    // extreme points of the texels along their principal axis (power iteration on the covariance) over the first channels
+    void fitEndpoints(const Block& block, const uint32_t channels, std::array<float, 4>& lo, std::array<float, 4>& hi)
+    {
+        std::array<float, 4> mean{};
+        for (const auto& texel : block) for (uint32_t c = 0; c < channels; c++) mean[c] += texel[c] / 16.0f;
+        std::array<std::array<float, 4>, 4> cov{};
+        for (const auto& texel : block) {
+            for (uint32_t i = 0; i < channels; i++) for (uint32_t j = 0; j < channels; j++) cov[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+        }
+        std::array<float, 4> axis{ 1.0f, 1.0f, 1.0f, 1.0f };
+        for (uint32_t iteration = 0; iteration < 8u; iteration++) {
+            std::array<float, 4> next{};
+            for (uint32_t i = 0; i < channels; i++) for (uint32_t j = 0; j < channels; j++) next[i] += cov[i][j] * axis[j];
+            float scale = 0.0f;
+            for (uint32_t c = 0; c < channels; c++) scale = std::max(scale, std::abs(next[c]));
+            if (scale == 0.0f) break; // flat block
+            for (uint32_t c = 0; c < channels; c++) axis[c] = next[c] / scale;
+        }
+        float axisLength2 = 0.0f;
+        for (uint32_t c = 0; c < channels; c++) axisLength2 += axis[c] * axis[c];
+
+        float tMin = 0.0f, tMax = 0.0f;
+        for (const auto& texel : block) {
+            float t = 0.0f;
+            for (uint32_t c = 0; c < channels; c++) t += (texel[c] - mean[c]) * axis[c];
+            t /= axisLength2;
+            tMin = std::min(tMin, t);
+            tMax = std::max(tMax, t);
+        }
+        for (uint32_t c = 0; c < 4u; c++) {
+            lo[c] = c < channels ? std::clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f) : 255.0f;
+            hi[c] = c < channels ? std::clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f) : 255.0f;
+        }
+    }
+
+    template<size_t N>
+    uint32_t nearest(const std::array<uint8_t, 4>& texel, const std::array<std::array<int32_t, 4>, N>& palette, const uint32_t channels)
+    {
+        uint32_t best = 0;
+        int32_t bestError = INT32_MAX;
+        for (uint32_t i = 0; i < N; i++) {
+            int32_t error = 0;
+            for (uint32_t c = 0; c < channels; c++) error += (texel[c] - palette[i][c]) * (texel[c] - palette[i][c]);
+            if (error < bestError) { best = i; bestError = error; }
+        }
+        return best;
+    }
+
+    uint16_t to565(const std::array<float, 4>& color)
+    {
+        const auto r = static_cast<uint16_t>(std::lround(color[0] * 31.0f / 255.0f));
+        const auto g = static_cast<uint16_t>(std::lround(color[1] * 63.0f / 255.0f));
+        const auto b = static_cast<uint16_t>(std::lround(color[2] * 31.0f / 255.0f));
+        return static_cast<uint16_t>(r << 11u | g << 5u | b);
+    }
+
+    std::array<int32_t, 4> from565(const uint16_t color)
+    {
+        const int32_t r = color >> 11u & 31u, g = color >> 5u & 63u, b = color & 31u;
+        return { r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 255 };
+    }
+
+    // 4 color mode only, so the block reads the same in BC1 and in BC3
+    void encodeColor(const Block& block, std::byte* out)
+    {
+        std::array<float, 4> lo, hi;
+        fitEndpoints(block, 3u, lo, hi);
+        uint16_t c0 = to565(hi), c1 = to565(lo);
+        if (c0 < c1) std::swap(c0, c1);
+
+        uint32_t indices = 0; // c0 == c1: every index 0 selects c0
+        if (c0 != c1) {
+            std::array<std::array<int32_t, 4>, 4> palette{ from565(c0), from565(c1) };
+            for (uint32_t c = 0; c < 3u; c++) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for (uint32_t i = 0; i < 16u; i++) indices |= nearest(block[i], palette, 3u) << (2u * i);
+        }
+        const std::array<uint16_t, 2> endpoints{ c0, c1 };
+        std::memcpy(out, endpoints.data(), 4u);
+        std::memcpy(out + 4, &indices, 4u);
+    }
+
+    // 8 alpha mode (a0 > a1) with 3 bit indices
+    void encodeAlpha(const Block& block, std::byte* out)
+    {
+        uint8_t a0 = 0, a1 = 255;
+        for (const auto& texel : block) { a0 = std::max(a0, texel[3]); a1 = std::min(a1, texel[3]); }
+
+        uint64_t indices = 0; // a0 == a1: every index 0 selects a0
+        if (a0 != a1) {
+            std::array<int32_t, 8> palette{ a0, a1 };
+            for (int32_t k = 2; k < 8; k++) palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+            for (uint32_t i = 0; i < 16u; i++) {
+                const auto best = std::ranges::min_element(palette, {}, [&](const int32_t a) { return std::abs(block[i][3] - a); }) - palette.begin();
+                indices |= static_cast<uint64_t>(best) << (3u * i);
+            }
+        }
+        out[0] = static_cast<std::byte>(a0);
+        out[1] = static_cast<std::byte>(a1);
+        for (uint32_t i = 0; i < 6u; i++) out[2 + i] = static_cast<std::byte>(indices >> (8u * i) & 0xffu);
+    }
+
+    struct BitWriter
+    {
+        std::array<uint64_t, 2> bits{};
+        uint32_t position = 0;
+        void put(const uint32_t value, const uint32_t count)
+        {
+            for (uint32_t i = 0; i < count; i++, position++) bits[position / 64u] |= static_cast<uint64_t>(value >> i & 1u) << (position % 64u);
+        }
+    };
+
+    void encodeBc7(const Block& block, std::byte* out)
+    {
+        std::array<float, 4> lo, hi;
+        fitEndpoints(block, 4u, lo, hi);
+
+        // 7 bit endpoint channels share one lsb (p-bit) per endpoint, the p-bit with the smaller error wins
+        std::array<std::array<uint32_t, 4>, 2> endpoints;
+        std::array<uint32_t, 2> pBits;
+        for (uint32_t e = 0; e < 2u; e++) {
+            const auto& color = e == 0 ? lo : hi;
+            float bestError = INFINITY;
+            for (uint32_t p = 0; p < 2u; p++) {
+                std::array<uint32_t, 4> quantized;
+                float error = 0.0f;
+                for (uint32_t c = 0; c < 4u; c++) {
+                    quantized[c] = static_cast<uint32_t>(std::clamp(std::lround((color[c] - p) / 2.0f), 0l, 127l));
+                    const float d = static_cast<float>(quantized[c] << 1u | p) - color[c];
+                    error += d * d;
+                }
+                if (error < bestError) { bestError = error; endpoints[e] = quantized; pBits[e] = p; }
+            }
+        }
+
+        constexpr std::array<int32_t, 16> weights{ 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+        std::array<std::array<int32_t, 4>, 16> palette;
+        for (uint32_t i = 0; i < 16u; i++) {
+            for (uint32_t c = 0; c < 4u; c++) {
+                const auto e0 = static_cast<int32_t>(endpoints[0][c] << 1u | pBits[0]), e1 = static_cast<int32_t>(endpoints[1][c] << 1u | pBits[1]);
+                palette[i][c] = ((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6;
+            }
+        }
+        std::array<uint32_t, 16> indices;
+        for (uint32_t i = 0; i < 16u; i++) indices[i] = nearest(block[i], palette, 4u);
+        // the msb of the first index is implicit 0, the weights are symmetric so swapping the endpoints mirrors the indices
+        if (indices[0] >= 8u) {
+            std::swap(endpoints[0], endpoints[1]);
+            std::swap(pBits[0], pBits[1]);
+            for (auto& index : indices) index = 15u - index;
+        }
+
+        BitWriter writer;
+        writer.put(1u << 6u, 7u); // mode 6
+        for (uint32_t c = 0; c < 4u; c++) { writer.put(endpoints[0][c], 7u); writer.put(endpoints[1][c], 7u); }
+        writer.put(pBits[0], 1u);
+        writer.put(pBits[1], 1u);
+        writer.put(indices[0], 3u);
+        for (uint32_t i = 1; i < 16u; i++) writer.put(indices[i], 4u);
+        std::memcpy(out, writer.bits.data(), 16u);
+    }
+
+    // 2x2 box filter, odd edges reuse the last column/row
+    std::vector<uint8_t> downsample(const std::vector<uint8_t>& src, const uint32_t width, const uint32_t height, utils::ThreadPool* pool)
+    {
+        const uint32_t w = std::max(width / 2u, 1u), h = std::max(height / 2u, 1u);
+        std::vector<uint8_t> dst(static_cast<size_t>(w) * h * 4u);
+        const auto row = [&](const uint32_t y) {
+            const uint32_t y0 = std::min(y * 2u, height - 1u), y1 = std::min(y * 2u + 1u, height - 1u);
+            for (uint32_t x = 0; x < w; x++) {
+                const uint32_t x0 = std::min(x * 2u, width - 1u), x1 = std::min(x * 2u + 1u, width - 1u);
+                for (uint32_t c = 0; c < 4u; c++) {
+                    const uint32_t sum = src[(static_cast<size_t>(y0) * width + x0) * 4u + c] + src[(static_cast<size_t>(y0) * width + x1) * 4u + c]
+                        + src[(static_cast<size_t>(y1) * width + x0) * 4u + c] + src[(static_cast<size_t>(y1) * width + x1) * 4u + c];
+                    dst[(static_cast<size_t>(y) * w + x) * 4u + c] = static_cast<uint8_t>((sum + 2u) / 4u);
+                }
+            }
+        };
+        if (pool) pool->parallelFor(h, row);
+        else for (uint32_t y = 0; y < h; y++) row(y);
+        return dst;
+    }
+}
+
+vk::Format bc::format(const Codec codec, const bool srgb)
+{
+    switch (codec) {
+        case Codec::BC1: return srgb ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eBc1RgbUnormBlock;
+        case Codec::BC3: return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+        case Codec::BC7: return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+    }
+    return vk::Format::eUndefined;
+}
+
+size_t bc::encodedSize(const Codec codec, const uint32_t width, const uint32_t height)
+{
+    return static_cast<size_t>((width + 3u) / 4u) * ((height + 3u) / 4u) * blockBytes(codec);
+}
+
+void bc::encode(const Codec codec, const uint8_t* rgba, const uint32_t width, const uint32_t height, std::byte* dst, utils::ThreadPool* pool)
+{
+    if (width == 0 || height == 0) throw std::invalid_argument{ "Can not encode an empty image" };
+    const uint32_t blocksX = (width + 3u) / 4u, blocksY = (height + 3u) / 4u;
+    const auto row = [&](const uint32_t by) {
+        for (uint32_t bx = 0; bx < blocksX; bx++) {
+            const Block block = fetch(rgba, width, height, bx, by);
+            std::byte* out = dst + (static_cast<size_t>(by) * blocksX + bx) * blockBytes(codec);
+            switch (codec) {
+                case Codec::BC1: encodeColor(block, out); break;
+                case Codec::BC3: encodeAlpha(block, out); encodeColor(block, out + 8); break;
+                case Codec::BC7: encodeBc7(block, out); break;
+            }
+        }
+    };
+    if (pool) pool->parallelFor(blocksY, row);
+    else for (uint32_t by = 0; by < blocksY; by++) row(by);
+}
+
+std::vector<std::byte> bc::encode(const Codec codec, const uint8_t* rgba, const uint32_t width, const uint32_t height, utils::ThreadPool* pool)
+{
+    std::vector<std::byte> encoded(encodedSize(codec, width, height));
+    encode(codec, rgba, width, height, encoded.data(), pool);
+    return encoded;
+}
+
+std::vector<std::byte> bc::encodeMips(const Codec codec, const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t mipLevels, utils::ThreadPool* pool)
+{
+    if (width == 0 || height == 0) throw std::invalid_argument{ "Can not encode an empty image" };
+    const auto fullCount = static_cast<uint32_t>(std::bit_width(std::max({ width, height, 1u })));
+    mipLevels = mipLevels == 0 ? fullCount : std::min(mipLevels, fullCount);
+
+    size_t size = 0;
+    for (uint32_t mip = 0; mip < mipLevels; mip++) size += encodedSize(codec, std::max(width >> mip, 1u), std::max(height >> mip, 1u));
+    std::vector<std::byte> encoded(size);
+
+    std::vector<uint8_t> level(rgba, rgba + static_cast<size_t>(width) * height * 4u);
+    size_t offset = 0;
+    for (uint32_t mip = 0; mip < mipLevels; mip++) {
+        encode(codec, level.data(), width, height, encoded.data() + offset, pool);
+        offset += encodedSize(codec, width, height);
+        if (mip + 1u == mipLevels) break;
+        level = downsample(level, width, height, pool);
+        width = std::max(width / 2u, 1u);
+        height = std::max(height / 2u, 1u);
+    }
+    return encoded;
+}
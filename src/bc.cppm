@@ -0,0 +1,29 @@
+module;
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+export module evk:bc;
+import :utils;
+import vulkan;
+
+// CPU encoder for block compressed textures, 4x4 texel blocks of rgba8 input
+export namespace evk::bc
+{
+    enum class Codec
+    {
+        BC1, // rgb, 4 bpp, alpha is dropped
+        BC3, // rgba, 8 bpp, interpolated alpha
+        BC7 // rgba, 8 bpp, mode 6 only (one subset, 7 bit endpoints with p-bits, 4 bit indices)
+    };
+
+    [[nodiscard]] EVK_API constexpr uint32_t blockBytes(const Codec codec) { return codec == Codec::BC1 ? 8u : 16u; }
+    [[nodiscard]] EVK_API vk::Format format(Codec codec, bool srgb = false);
+    [[nodiscard]] EVK_API size_t encodedSize(Codec codec, uint32_t width, uint32_t height);
+
+    // rgba holds rows of width texels, blocks over the right/bottom edge repeat the last column/row.
+    // Rows of blocks are spread over pool when one is given. Throws std::invalid_argument for a zero width or height
+    EVK_API void encode(Codec codec, const uint8_t* rgba, uint32_t width, uint32_t height, std::byte* dst, utils::ThreadPool* pool = nullptr);
+    [[nodiscard]] EVK_API std::vector<std::byte> encode(Codec codec, const uint8_t* rgba, uint32_t width, uint32_t height, utils::ThreadPool* pool = nullptr);
+    // box filtered mip chain (mipLevels = 0 for the full one), the mips encoded one after another as UploadEngine::upload expects them
+    [[nodiscard]] EVK_API std::vector<std::byte> encodeMips(Codec codec, const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t mipLevels = 0, utils::ThreadPool* pool = nullptr);
+}
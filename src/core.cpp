@@ -1,4 +1,6 @@
 module;
+#include <algorithm>
+#include <iterator>
 #include <cstdint>
 #include <optional>
 #include <stdexcept>
@@ -7,6 +9,29 @@ module;
 #include <memory>
 #include <cstring>
 #include <deque>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <cstddef>
+#include <cmath>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <unordered_map>
+#include <bit>
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 module evk;
 import :core;
 import :utils;
@@ -18,6 +43,43 @@ namespace
         vk::StructureType sType;
         void* pNext;
     };
+
+    vk::raii::Semaphore createTimelineSemaphore(const vk::raii::Device& device)
+    {
+        const vk::SemaphoreTypeCreateInfo semaphoreTypeCreateInfo{ vk::SemaphoreType::eTimeline, 0 };
+        return { device, vk::SemaphoreCreateInfo{ {}, &semaphoreTypeCreateInfo } };
+    }
+
+    constexpr auto externalMemoryHandleType = isWindows ? vk::ExternalMemoryHandleTypeFlagBits::eOpaqueWin32 : vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
+    constexpr auto externalSemaphoreHandleType = isWindows ? vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueWin32 : vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueFd;
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+    using ImportMemoryInfo = vk::ImportMemoryWin32HandleInfoKHR;
+#else
+    using ImportMemoryInfo = vk::ImportMemoryFdInfoKHR;
+#endif
+
+    ExternalHandle exportMemory(const Device& device, const vk::DeviceMemory memory)
+    {
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+        return (ExternalHandle)device.getMemoryWin32HandleKHR({ memory, externalMemoryHandleType });
+#else
+        return (ExternalHandle)device.getMemoryFdKHR({ memory, externalMemoryHandleType });
+#endif
+    }
+
+    // a second handle to the same memory, owned by the caller
+    ExternalHandle duplicateHandle(const ExternalHandle handle)
+    {
+#ifdef _WIN32
+        HANDLE duplicate = nullptr;
+        if (!DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &duplicate, 0, FALSE, DUPLICATE_SAME_ACCESS)) throw std::runtime_error{ "Failed to duplicate handle" };
+        return duplicate;
+#else
+        const int duplicate = dup(handle);
+        if (duplicate < 0) throw std::runtime_error{ "Failed to duplicate fd" };
+        return duplicate;
+#endif
+    }
 }
 
 void Queue::submitAndWaitIdle(vk::ArrayProxy<const vk::SubmitInfo> const& submits, const vk::Fence fence) const
@@ -41,38 +103,79 @@ Device::Device(
 ) : vk::raii::Device{ nullptr }, physicalDevice{ physicalDevice }, memoryProperties{ physicalDevice.getMemoryProperties() }
 {
     _instance = instance;
-    const auto prop = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties, vk::PhysicalDeviceRayTracingPipelinePropertiesKHR, vk::PhysicalDeviceAccelerationStructurePropertiesKHR, vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+    const auto prop = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties, vk::PhysicalDeviceRayTracingPipelinePropertiesKHR, vk::PhysicalDeviceAccelerationStructurePropertiesKHR, vk::PhysicalDeviceDescriptorBufferPropertiesEXT, vk::PhysicalDeviceExternalMemoryHostPropertiesEXT>();
     properties = prop.get<vk::PhysicalDeviceProperties2>().properties;
     subgroupProperties = prop.get<vk::PhysicalDeviceSubgroupProperties>();
     rayTracingPipelineProperties = prop.get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
     accelerationStructureProperties = prop.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
 	descriptorBufferProperties = prop.get<vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+    externalMemoryHostProperties = prop.get<vk::PhysicalDeviceExternalMemoryHostPropertiesEXT>();
+
+    // without explicit queues one queue of each discovered role family is created
+    const auto queueFamiliesProperties = physicalDevice.getQueueFamilyProperties();
+    Queues discovered;
+    if (queues.empty()) {
+        const auto families = utils::findQueueFamilies(queueFamiliesProperties);
+        for (const auto& family : { families.graphics, families.compute, families.transfer }) if (family) discovered[*family] = 1;
+    }
+    const Queues& created = queues.empty() ? discovered : queues;
+    if (created.empty()) throw std::runtime_error{ "No queue family found" };
 
     constexpr float priority = 1.0f;
     std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos;
-    deviceQueueCreateInfos.reserve(queues.size());
-    for (const auto& [queueFamilyIndex, queueCount] : queues) {
+    deviceQueueCreateInfos.reserve(created.size());
+    for (const auto& [queueFamilyIndex, queueCount] : created) {
         deviceQueueCreateInfos.emplace_back(vk::DeviceQueueCreateInfo{ {}, queueFamilyIndex, queueCount, &priority });
     }
     const vk::DeviceCreateInfo deviceCreateInfo{ {}, deviceQueueCreateInfos, {}, extensions,{}, pNext };
     vk::raii::Device::operator=({ physicalDevice, deviceCreateInfo });
+    allocator = std::make_unique<MemoryAllocator>(*this, memoryProperties, properties.limits.nonCoherentAtomSize);
+    vk::DeviceSize deviceLocalSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) deviceLocalSize = std::max(deviceLocalSize, memoryProperties.memoryHeaps[i].size);
+    }
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        constexpr vk::MemoryPropertyFlags bar = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible;
+        if ((memoryProperties.memoryTypes[i].propertyFlags & bar) != bar) continue;
+        barSize = std::max(barSize, memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size);
+    }
+    hasFullBar = barSize > 0 && barSize >= deviceLocalSize;
+    hasMemoryBudget = std::ranges::any_of(extensions, [](const char* e) { return std::string_view{ e } == vk::EXTMemoryBudgetExtensionName; });
+    hasExternalMemoryHost = std::ranges::any_of(extensions, [](const char* e) { return std::string_view{ e } == vk::EXTExternalMemoryHostExtensionName; });
 
     // get all our queues -> queue[family][index]
-    if (queues.empty()) throw std::invalid_argument{ "No queue indices specified" };
-    _queues.resize(physicalDevice.getQueueFamilyProperties().size());
-    for (const auto& [queueFamilyIndex, queueCount] : queues) {
+    _queues.resize(queueFamiliesProperties.size());
+    for (const auto& [queueFamilyIndex, queueCount] : created) {
         _queues[queueFamilyIndex] = std::vector<Queue>{ queueCount, {nullptr} };
         for (uint32_t i = 0; i < queueCount; ++i) _queues[queueFamilyIndex][i] = evk::Queue{ vk::raii::Device::getQueue(queueFamilyIndex, i) };
     }
+    // roles among the created families only
+    std::vector<uint32_t> notCreated;
+    for (uint32_t i = 0; i < queueFamiliesProperties.size(); ++i) if (!created.contains(i)) notCreated.push_back(i);
+    const auto roles = utils::findQueueFamilies(queueFamiliesProperties, notCreated);
+    graphicsFamily = roles.graphics;
+    computeFamily = roles.compute;
+    transferFamily = roles.transfer;
 
+    bool presentId = false, presentWait = false;
     auto* p = static_cast<VkStruct*>(pNext);
     while(p) {
-		if (p->sType == vk::StructureType::ePhysicalDeviceAccelerationStructureFeaturesKHR) {
+        if (p->sType == vk::StructureType::ePhysicalDeviceFeatures2) {
+            enabledFeatures = reinterpret_cast<vk::PhysicalDeviceFeatures2*>(p)->features;
+        }
+		else if (p->sType == vk::StructureType::ePhysicalDeviceAccelerationStructureFeaturesKHR) {
             const vk::PhysicalDeviceAccelerationStructureFeaturesKHR* s = reinterpret_cast<vk::PhysicalDeviceAccelerationStructureFeaturesKHR*>(p);
             hasAccelerationStructureActive = s->accelerationStructure;
 		}
+        else if (p->sType == vk::StructureType::ePhysicalDevicePresentIdFeaturesKHR) {
+            presentId = reinterpret_cast<vk::PhysicalDevicePresentIdFeaturesKHR*>(p)->presentId;
+        }
+        else if (p->sType == vk::StructureType::ePhysicalDevicePresentWaitFeaturesKHR) {
+            presentWait = reinterpret_cast<vk::PhysicalDevicePresentWaitFeaturesKHR*>(p)->presentWait;
+        }
 		p = static_cast<VkStruct*>(p->pNext);
 	}
+    hasPresentWait = presentId && presentWait;
 }
 
 std::optional<uint32_t> Device::findMemoryTypeIndex(const vk::MemoryRequirements& requirements, const vk::MemoryPropertyFlags propertyFlags) const
@@ -80,6 +183,48 @@ std::optional<uint32_t> Device::findMemoryTypeIndex(const vk::MemoryRequirements
     return utils::findMemoryTypeIndex(memoryProperties, requirements, propertyFlags);
 }
 
+uint32_t Device::selectMemoryType(const vk::MemoryRequirements& requirements, const vk::MemoryPropertyFlags propertyFlags) const
+{
+    return selectMemoryType(requirements, utils::MemoryTypeRequest{ propertyFlags, {}, {} });
+}
+
+uint32_t Device::selectMemoryType(const vk::MemoryRequirements& requirements, const utils::MemoryTypeRequest& request) const
+{
+    constexpr vk::MemoryPropertyFlags bar = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible;
+    const vk::MemoryPropertyFlags wanted = request.required | request.preferred;
+    auto memoryTypeIndex = utils::findMemoryTypeIndex(memoryProperties, requirements, request);
+    if (memoryTypeIndex.has_value() && !hasFullBar && (memoryProperties.memoryTypes[memoryTypeIndex.value()].propertyFlags & bar) == bar
+        && requirements.size > allocator->blockSize(memoryTypeIndex.value()) / 2u) {
+        memoryTypeIndex.reset();
+    }
+    if (memoryTypeIndex.has_value()) return memoryTypeIndex.value();
+
+    const vk::MemoryPropertyFlags required = request.required & vk::MemoryPropertyFlagBits::eHostVisible;
+    const vk::MemoryPropertyFlags avoided = request.avoided | ((wanted & bar) == bar ? vk::MemoryPropertyFlagBits::eDeviceLocal : vk::MemoryPropertyFlags{});
+    memoryTypeIndex = utils::findMemoryTypeIndex(memoryProperties, requirements, { required, wanted & ~avoided, avoided });
+    if (!memoryTypeIndex.has_value()) throw std::runtime_error{ "No memory type index found" };
+    return memoryTypeIndex.value();
+}
+
+MemoryStats Device::memoryStats() const
+{
+    MemoryStats stats = allocator->stats();
+    if (hasMemoryBudget) {
+        const auto memoryProperties2 = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        const auto& budget = memoryProperties2.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        for (size_t i = 0; i < stats.heaps.size(); i++) {
+            stats.heaps[i].budget = budget.heapBudget[i];
+            stats.heaps[i].usage = budget.heapUsage[i];
+        }
+    } else {
+        for (auto& heap : stats.heaps) {
+            heap.budget = heap.size;
+            heap.usage = heap.blocks.current;
+        }
+    }
+    return stats;
+}
+
 bool Device::imageFormatSupported(const vk::Format format, const vk::ImageType type, const vk::ImageTiling tiling, const vk::ImageUsageFlags usage, const vk::ImageCreateFlags flags) const
 {
     try {
@@ -114,52 +259,410 @@ vk::raii::CommandBuffer CommandPool::allocateCommandBuffer(vk::CommandBufferLeve
     return std::move(cb[0]);
 }
 
-Buffer::Buffer() : Resource{ nullptr }, buffer{ nullptr }, memory{ nullptr }, deviceAddress{ 0 }, size{ 0 } {}
+vk::raii::CommandBuffer CommandPool::acquire(const vk::CommandBufferLevel level)
+{
+    // a whole pool reset would also reset the buffers handed out by allocateCommandBuffer
+    if (!(flags & vk::CommandPoolCreateFlagBits::eResetCommandBuffer)) throw std::runtime_error{ "Recycling needs a pool created with eResetCommandBuffer" };
+    auto& free = _free[static_cast<size_t>(level)];
+    if (free.empty()) collect();
+    if (free.empty()) return allocateCommandBuffer(level);
+    auto cb = std::move(free.back());
+    free.pop_back();
+    return cb;
+}
+
+vk::Fence CommandPool::acquireFence()
+{
+    if (_freeFences.empty()) collect();
+    if (_freeFences.empty()) return *_fences.emplace_back(*dev, vk::FenceCreateInfo{});
+    const auto fence = _freeFences.back();
+    _freeFences.pop_back();
+    return fence;
+}
+
+void CommandPool::release(vk::raii::CommandBuffer&& commandBuffer, const vk::Fence fence, const vk::CommandBufferLevel level)
+{
+    if (!fence) {
+        _retired[static_cast<size_t>(level)].push_back(std::move(commandBuffer));
+        return;
+    }
+    auto it = std::ranges::find(_inFlight, fence, &InFlight::fence);
+    if (it == _inFlight.end()) it = _inFlight.insert(_inFlight.end(), InFlight{ fence, {} });
+    it->commandBuffers.emplace_back(level, std::move(commandBuffer));
+}
+
+void CommandPool::collect()
+{
+    std::vector<vk::Fence> signaled;
+    for (auto it = _inFlight.begin(); it != _inFlight.end();) {
+        if (dev->waitForFences(it->fence, true, 0) != vk::Result::eSuccess) { ++it; continue; }
+        signaled.push_back(it->fence);
+        for (auto& [level, cb] : it->commandBuffers) _retired[static_cast<size_t>(level)].push_back(std::move(cb));
+        it = _inFlight.erase(it);
+    }
+    if (!signaled.empty()) {
+        dev->resetFences(signaled);
+        _freeFences.insert(_freeFences.end(), signaled.begin(), signaled.end());
+    }
+
+    for (size_t level = 0; level < 2; ++level) {
+        for (auto& cb : _retired[level]) {
+            cb.reset();
+            _free[level].push_back(std::move(cb));
+        }
+        _retired[level].clear();
+    }
+}
+
+void CommandPool::submitImmediate(const vk::raii::Queue& queue, const std::function<void(const vk::raii::CommandBuffer&)>& record)
+{
+    auto cb = acquire();
+    const auto fence = acquireFence();
+    try {
+        cb.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+        record(cb);
+        cb.end();
+        const vk::CommandBufferSubmitInfo cbInfo{ *cb };
+        queue.submit2(vk::SubmitInfo2{}.setCommandBufferInfos(cbInfo), fence);
+    }
+    catch (...) {
+        release(std::move(cb), nullptr);
+        _freeFences.push_back(fence);
+        throw;
+    }
+    release(std::move(cb), fence);
+    checkResult(dev->waitForFences(fence, true, UINT64_MAX), "Failed to wait for immediate submit");
+    collect();
+}
+
+QueueSubmitter::QueueSubmitter(
+    const evk::SharedPtr<Device>& device,
+    const Device::QueueFamily queueFamily,
+    const Device::QueueCount queueIndex,
+    const uint32_t capacity
+) : Resource{ device }, queue{ &dev->getQueue(queueFamily, queueIndex) }, semaphore{ createTimelineSemaphore(*dev) }
+{
+    const uint64_t cellCount = std::bit_ceil(std::max(capacity, 2u));
+    _cells = std::make_unique<Cell[]>(cellCount);
+    _mask = cellCount - 1;
+    for (uint64_t i = 0; i < cellCount; ++i) _cells[i].sequence.store(i, std::memory_order_relaxed);
+    _thread = std::thread{ &QueueSubmitter::_run, this };
+}
+
+QueueSubmitter::~QueueSubmitter()
+{
+    if (!_thread.joinable()) return;
+    _stop.store(true);
+    _pushed.fetch_add(1, std::memory_order_release);
+    _pushed.notify_one();
+    _thread.join();
+    if (!_failed.load()) wait({ _submitted.load() });
+}
+
+QueueSubmitter::Ticket QueueSubmitter::submit(Submit submit)
+{
+    _rethrow();
+    // bounded mpmc ring (Vyukov), a cell is free for position pos when its sequence equals pos and written when it equals pos + 1
+    uint64_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &_cells[pos & _mask];
+        const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+        if (sequence == pos) {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else {
+            if (sequence < pos) std::this_thread::yield(); // full, the submission thread is behind
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->submit = std::move(submit);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    _pushed.fetch_add(1, std::memory_order_release);
+    _pushed.notify_one();
+    return { pos + 1 };
+}
+
+void QueueSubmitter::flush(const Ticket ticket) const
+{
+    for (uint64_t submitted = _submitted.load(std::memory_order_acquire); submitted < ticket.value; submitted = _submitted.load(std::memory_order_acquire)) {
+        _submitted.wait(submitted, std::memory_order_acquire);
+    }
+    _rethrow();
+}
+
+vk::Result QueueSubmitter::present(const vk::PresentInfoKHR& presentInfo)
+{
+    flush({ _enqueuePos.load() });
+    std::scoped_lock lock{ _queueMutex };
+    return queue->presentKHR(presentInfo);
+}
+
+void QueueSubmitter::waitIdle()
+{
+    flush({ _enqueuePos.load() });
+    std::scoped_lock lock{ _queueMutex };
+    queue->waitIdle();
+}
+
+bool QueueSubmitter::isComplete(const Ticket ticket) const
+{
+    if (semaphore.getCounterValue() >= ticket.value) return true;
+    _rethrow(ticket);
+    return false;
+}
+
+bool QueueSubmitter::wait(const Ticket ticket, uint64_t timeout) const
+{
+    if (ticket.value == 0) return true;
+    // waits in slices, a failed submit never signals its tickets and would block forever
+    constexpr uint64_t slice = 10'000'000;
+    while (true) {
+        const uint64_t step = std::min(timeout, slice);
+        if (dev->waitSemaphores(vk::SemaphoreWaitInfo{ {}, *semaphore, ticket.value }, step) == vk::Result::eSuccess) return true;
+        _rethrow(ticket);
+        if (timeout != UINT64_MAX) timeout -= step;
+        if (timeout == 0) return false;
+    }
+}
+
+void QueueSubmitter::_run()
+{
+    std::vector<Submit> records;
+    std::vector<vk::SubmitInfo2> submitInfos;
+    while (true) {
+        const uint64_t pushed = _pushed.load(std::memory_order_acquire);
+        // take the written records in position order, at most one ring worth so producers waiting on a full ring get going again
+        while (records.size() <= _mask) {
+            Cell& cell = _cells[_dequeuePos & _mask];
+            if (cell.sequence.load(std::memory_order_acquire) != _dequeuePos + 1) break;
+            records.push_back(std::move(cell.submit));
+            cell.sequence.store(_dequeuePos + _mask + 1, std::memory_order_release);
+            ++_dequeuePos;
+        }
+        if (records.empty()) {
+            if (_stop.load()) return;
+            _pushed.wait(pushed, std::memory_order_acquire);
+            continue;
+        }
+
+        // one submit2 for all records, split only after records that carry a fence
+        const uint64_t firstValue = _dequeuePos - records.size() + 1;
+        for (size_t i = 0; i < records.size(); ++i) {
+            records[i].signals.emplace_back(*semaphore, firstValue + i, vk::PipelineStageFlagBits2::eAllCommands);
+        }
+        // after a failure the remaining records are dropped, so every ticket from the failed one on stays unsignaled
+        size_t chunkBegin = 0;
+        try {
+            std::scoped_lock lock{ _queueMutex };
+            for (size_t i = 0; i < records.size() && !_failed.load(); ++i) {
+                const auto& record = records[i];
+                submitInfos.push_back(vk::SubmitInfo2{ {}, record.waits, record.commandBuffers, record.signals });
+                if (record.fence || i + 1 == records.size()) {
+                    queue->submit2(submitInfos, record.fence);
+                    submitInfos.clear();
+                    chunkBegin = i + 1;
+                }
+            }
+        }
+        catch (...) {
+            _error = std::current_exception();
+            _failedValue = firstValue + chunkBegin;
+            _failed.store(true, std::memory_order_release);
+        }
+        _submitted.store(_dequeuePos, std::memory_order_release);
+        _submitted.notify_all();
+        records.clear();
+        submitInfos.clear();
+    }
+}
+
+void QueueSubmitter::_rethrow() const
+{
+    if (_failed.load(std::memory_order_acquire)) std::rethrow_exception(_error);
+}
+
+void QueueSubmitter::_rethrow(const Ticket ticket) const
+{
+    if (_failed.load(std::memory_order_acquire) && ticket.value >= _failedValue) std::rethrow_exception(_error);
+}
+
+Buffer::Buffer() : Resource{ nullptr }, buffer{ nullptr }, deviceAddress{ 0 }, size{ 0 }, _dedicated{ false } {}
 Buffer::Buffer(
     const evk::SharedPtr<Device>& device,
     vk::DeviceSize size,
     const vk::BufferUsageFlags usageFlags,
     const vk::MemoryPropertyFlags memoryPropertyFlags,
-    bool exportable
-) : Resource{ device }, buffer{ nullptr }, memory{ nullptr }, deviceAddress{ 0 }, size{ 0 }, _usageFlags{ usageFlags }, _memoryPropertyFlags{ memoryPropertyFlags }, externalHandle{ (EXPORT_HANDLE) exportable }
+    bool exportable,
+    bool dedicated,
+    const std::string_view tag
+) : Buffer{ device, size, usageFlags, utils::MemoryTypeRequest{ memoryPropertyFlags, {}, {} }, exportable, dedicated, tag } {}
+
+Buffer::Buffer(
+    const evk::SharedPtr<Device>& device,
+    vk::DeviceSize size,
+    const vk::BufferUsageFlags usageFlags,
+    const utils::MemoryTypeRequest& memoryRequest,
+    bool exportable,
+    bool dedicated,
+    const std::string_view tag
+) : Resource{ device }, buffer{ nullptr }, deviceAddress{ 0 }, size{ 0 }, _usageFlags{ usageFlags }, _memoryRequest{ memoryRequest }, _dedicated{ dedicated }, _tag{ tag }, externalHandle{ (EXPORT_HANDLE) exportable }
 {
     resize(size);
 }
 
+Buffer::Buffer(
+    const evk::SharedPtr<Device>& device,
+    const ImportHandle importHandle,
+    const vk::DeviceSize size,
+    const vk::BufferUsageFlags usageFlags,
+    const vk::MemoryPropertyFlags memoryPropertyFlags,
+    const std::string_view tag
+) : Resource{ device }, buffer{ nullptr }, deviceAddress{ 0 }, size{ size }, _usageFlags{ usageFlags }, _memoryRequest{ memoryPropertyFlags, {}, {} }, _dedicated{ true }, _tag{ tag }, _imported{ true }, externalHandle{ importHandle.handle }
+{
+    const vk::ExternalMemoryBufferCreateInfo externalBufferInfo{ externalMemoryHandleType };
+    buffer = vk::raii::Buffer{ *dev, { {}, size, _usageFlags, vk::SharingMode::eExclusive, {}, {}, &externalBufferInfo } };
+    const auto memoryRequirements = buffer.getMemoryRequirements();
+    const uint32_t memoryTypeIndex = dev->selectMemoryType(memoryRequirements, _memoryRequest);
+
+    // the exporter allocated dedicated memory, so the import is dedicated to this buffer as well
+    const ImportMemoryInfo importInfo{ externalMemoryHandleType, importHandle.handle };
+    const vk::MemoryDedicatedAllocateInfo dedicatedInfo{ {}, *buffer, &importInfo };
+    memory = dev->allocator->allocateDedicated(memoryRequirements, memoryTypeIndex, &dedicatedInfo, _tag);
+    buffer.bindMemory(*memory, memory.offset);
+    memoryPropertyFlags = dev->memoryProperties.memoryTypes[memory.memoryTypeIndex].propertyFlags;
+    if (memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) auto _ = memory.map();
+
+    if (_usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) deviceAddress = dev->getBufferAddress({ *buffer });
+}
+
+Buffer::Buffer(
+    const evk::SharedPtr<Device>& device,
+    void* hostPointer,
+    const vk::DeviceSize size,
+    const vk::BufferUsageFlags usageFlags,
+    const std::string_view tag
+) : Resource{ device }, buffer{ nullptr }, deviceAddress{ 0 }, size{ size }, _usageFlags{ usageFlags }, _dedicated{ true }, _tag{ tag }, _hostPointer{ hostPointer }, externalHandle{}
+{
+    if (!dev->hasExternalMemoryHost) throw std::runtime_error{ "VK_EXT_external_memory_host is not enabled" };
+    const vk::DeviceSize alignment = dev->externalMemoryHostProperties.minImportedHostPointerAlignment;
+    if (reinterpret_cast<uintptr_t>(hostPointer) % alignment != 0 || size % alignment != 0) {
+        throw std::invalid_argument{ "Host pointer and size must be multiples of minImportedHostPointerAlignment" };
+    }
+
+    constexpr auto handleType = vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT;
+    const vk::ExternalMemoryBufferCreateInfo externalBufferInfo{ handleType };
+    buffer = vk::raii::Buffer{ *dev, { {}, size, _usageFlags, vk::SharingMode::eExclusive, {}, {}, &externalBufferInfo } };
+
+    // the pointer decides which memory types can back it, usually host cached and coherent ones
+    vk::MemoryRequirements memoryRequirements = buffer.getMemoryRequirements();
+    memoryRequirements.memoryTypeBits &= dev->getMemoryHostPointerPropertiesEXT(handleType, hostPointer).memoryTypeBits;
+    // the allocation is exactly the imported range, which has to hold everything the buffer needs
+    if (memoryRequirements.size > size || reinterpret_cast<uintptr_t>(hostPointer) % memoryRequirements.alignment != 0) {
+        throw std::invalid_argument{ "Imported host memory does not satisfy the buffer's memory requirements" };
+    }
+    memoryRequirements.size = size;
+    const auto memoryTypeIndex = utils::findMemoryTypeIndex(dev->memoryProperties, memoryRequirements, { vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent });
+    if (!memoryTypeIndex.has_value()) throw std::runtime_error{ "No memory type can import the host pointer" };
+
+    const vk::ImportMemoryHostPointerInfoEXT importInfo{ handleType, hostPointer };
+    memory = dev->allocator->allocateDedicated(memoryRequirements, memoryTypeIndex.value(), &importInfo, _tag);
+    buffer.bindMemory(*memory, memory.offset);
+    memoryPropertyFlags = dev->memoryProperties.memoryTypes[memory.memoryTypeIndex].propertyFlags;
+    _memoryRequest = { memoryPropertyFlags, {}, {} };
+    // the host keeps using its own pointer, no vkMapMemory needed
+    memory.mapped = hostPointer;
+
+    if (_usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) deviceAddress = dev->getBufferAddress({ *buffer });
+}
+
 void Buffer::resize(const vk::DeviceSize& s)
 {
     if (s == size) return;
+    if (_hostPointer || _imported) throw std::runtime_error{ "Buffers importing memory can not be resized" };
     size = s;
 
-    constexpr auto extFlags = isWindows ? vk::ExternalMemoryHandleTypeFlagBits::eOpaqueWin32 : vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
-    vk::ExternalMemoryBufferCreateInfo externalBufferInfo = { extFlags };
-
-    buffer = vk::raii::Buffer{ *dev, { {}, size, _usageFlags, vk::SharingMode::eExclusive, {}, {}, externalHandle ? externalBufferInfo : nullptr  } };
-    const auto memoryRequirements = buffer.getMemoryRequirements();
-    const auto memoryTypeIndex = dev->findMemoryTypeIndex(memoryRequirements, _memoryPropertyFlags);
-    if (!memoryTypeIndex.has_value()) throw std::runtime_error{ "No memory type index found" };
+    vk::ExternalMemoryBufferCreateInfo externalBufferInfo = { externalMemoryHandleType };
 
-    constexpr vk::ExportMemoryAllocateInfo exportInfo{ extFlags };
-    const vk::MemoryAllocateFlagsInfo memoryAllocateFlagsInfo{ vk::MemoryAllocateFlagBits::eDeviceAddress, {}, externalHandle ? exportInfo : nullptr };
+    memory = {};
+    _dirtyRanges.clear();
+    buffer = vk::raii::Buffer{ *dev, { {}, size, _usageFlags, vk::SharingMode::eExclusive, {}, {}, externalHandle ? &externalBufferInfo : nullptr  } };
+    const auto memoryRequirements2 = dev->getBufferMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>({ *buffer });
+    const auto& memoryRequirements = memoryRequirements2.get<vk::MemoryRequirements2>().memoryRequirements;
+    const auto& dedicatedRequirements = memoryRequirements2.get<vk::MemoryDedicatedRequirements>();
+    const uint32_t memoryTypeIndex = dev->selectMemoryType(memoryRequirements, _memoryRequest);
 
-    const vk::MemoryAllocateInfo memoryAllocateInfo{ memoryRequirements.size, memoryTypeIndex.value(), &memoryAllocateFlagsInfo };
-    memory = vk::raii::DeviceMemory{ *dev, memoryAllocateInfo };
-    buffer.bindMemory(*memory, 0);
+    // exported memory is shared as a whole, so it can not be sub-allocated
+    if (externalHandle || _dedicated || dedicatedRequirements.requiresDedicatedAllocation || dedicatedRequirements.prefersDedicatedAllocation) {
+        constexpr vk::ExportMemoryAllocateInfo exportInfo{ externalMemoryHandleType };
+        const vk::MemoryDedicatedAllocateInfo dedicatedInfo{ {}, *buffer, externalHandle ? &exportInfo : nullptr };
+        memory = dev->allocator->allocateDedicated(memoryRequirements, memoryTypeIndex, &dedicatedInfo, _tag);
+    }
+    else memory = dev->allocator->allocate(memoryRequirements, memoryTypeIndex, false, _tag);
+    buffer.bindMemory(*memory, memory.offset);
+    memoryPropertyFlags = dev->memoryProperties.memoryTypes[memory.memoryTypeIndex].propertyFlags;
+    if (memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) auto _ = memory.map();
 
     if (_usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) {
         const vk::BufferDeviceAddressInfo bufferDeviceAddressInfo{ *buffer };
         deviceAddress = dev->getBufferAddress(bufferDeviceAddressInfo); /* for bindless rendering */
     }
 
-    if (externalHandle) {
-        #ifdef VK_USE_PLATFORM_WIN32_KHR
-            vk::MemoryGetWin32HandleInfoKHR getHandleInfo{ memory, vk::ExternalMemoryHandleTypeFlagBits::eOpaqueWin32 };
-            externalHandle = (EXPORT_HANDLE)dev->getMemoryWin32HandleKHR(getHandleInfo);
-        #else
-            vk::MemoryGetFdInfoKHR getFdInfo{ memory, vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd };
-            externalHandle = (EXPORT_HANDLE)dev->getMemoryFdKHR(getFdInfo);
-        #endif
+    if (externalHandle) externalHandle = exportMemory(*dev, *memory);
+}
+
+void Buffer::write(const void* src, const vk::DeviceSize byteSize, const vk::DeviceSize byteOffset)
+{
+    if (byteOffset + byteSize > size) throw std::out_of_range{ "Write exceeds buffer size" };
+    std::memcpy(data().data() + byteOffset, src, byteSize);
+    markDirty(byteOffset, byteSize);
+}
+
+void Buffer::markDirty(const vk::DeviceSize byteOffset, vk::DeviceSize byteSize)
+{
+    if (isHostCoherent()) return;
+    if (byteSize == vk::WholeSize) byteSize = size - byteOffset;
+    _dirtyRanges.emplace_back(byteOffset, byteOffset + byteSize);
+}
+
+void Buffer::flush()
+{
+    flush({ this });
+}
+
+void Buffer::flush(const std::vector<Buffer*>& buffers)
+{
+    std::vector<vk::MappedMemoryRange> ranges;
+    for (Buffer* b : buffers) {
+        if (b->_dirtyRanges.empty()) continue;
+        // merge overlapping and touching ranges, then widen them to whole atoms
+        const vk::DeviceSize atom = b->dev->properties.limits.nonCoherentAtomSize;
+        const vk::DeviceSize blockSize = b->memory._block->size;
+        std::ranges::sort(b->_dirtyRanges);
+        auto [begin, end] = b->_dirtyRanges.front();
+        const auto push = [&] {
+            const vk::DeviceSize alignedBegin = utils::roundDownTooMultipleOfPowerOf2(b->memory.offset + begin, atom);
+            const vk::DeviceSize alignedEnd = std::min(utils::roundUpToMultipleOf(b->memory.offset + end, atom), blockSize);
+            ranges.emplace_back(*b->memory, alignedBegin, alignedEnd - alignedBegin);
+        };
+        for (const auto& [rBegin, rEnd] : b->_dirtyRanges) {
+            if (rBegin <= end) end = std::max(end, rEnd);
+            else { push(); begin = rBegin; end = rEnd; }
+        }
+        push();
+        b->_dirtyRanges.clear();
     }
+    if (!ranges.empty()) buffers.front()->dev->flushMappedMemoryRanges(ranges);
+}
+
+void Buffer::invalidate(const vk::DeviceSize byteOffset, vk::DeviceSize byteSize) const
+{
+    if (isHostCoherent()) return;
+    if (byteSize == vk::WholeSize) byteSize = size - byteOffset;
+    const vk::DeviceSize atom = dev->properties.limits.nonCoherentAtomSize;
+    const vk::DeviceSize alignedBegin = utils::roundDownTooMultipleOfPowerOf2(memory.offset + byteOffset, atom);
+    const vk::DeviceSize alignedEnd = std::min(utils::roundUpToMultipleOf(memory.offset + byteOffset + byteSize, atom), memory._block->size);
+    dev->invalidateMappedMemoryRanges(vk::MappedMemoryRange{ *memory, alignedBegin, alignedEnd - alignedBegin });
 }
 
 Image::Image(
@@ -168,11 +671,39 @@ Image::Image(
     const vk::Format format,
     const vk::ImageTiling tiling,
     const vk::ImageUsageFlags usageFlags,
-    const vk::MemoryPropertyFlags memoryPropertyFlags
-) : Resource{ device }, image{ nullptr }, imageView{ nullptr }, memory{ nullptr }, format{ format }, 
-    aspectMask{ utils::formatToAspectMask(format) }, _tiling{ tiling }, _usageFlags{ usageFlags }, _memoryPropertyFlags{ memoryPropertyFlags }
+    const vk::MemoryPropertyFlags memoryPropertyFlags,
+    const bool allocateMemory,
+    const std::string_view tag,
+    const uint32_t mipLevels,
+    const uint32_t arrayLayers,
+    const vk::ImageCreateFlags createFlags,
+    const bool exportable,
+    const vk::SampleCountFlagBits samples
+) : Image{ device, extent, format, tiling, usageFlags, utils::MemoryTypeRequest{ memoryPropertyFlags, {}, {} }, allocateMemory, tag, mipLevels, arrayLayers, createFlags, exportable, samples } {}
+
+Image::Image(
+    const evk::SharedPtr<Device>& device,
+    const vk::Extent3D extent,
+    const vk::Format format,
+    const vk::ImageTiling tiling,
+    const vk::ImageUsageFlags usageFlags,
+    const utils::MemoryTypeRequest& memoryRequest,
+    const bool allocateMemory,
+    const std::string_view tag,
+    const uint32_t mipLevels,
+    const uint32_t arrayLayers,
+    const vk::ImageCreateFlags createFlags,
+    const bool exportable,
+    const vk::SampleCountFlagBits samples
+) : Resource{ device }, image{ nullptr }, imageView{ nullptr }, format{ format },
+    aspectMask{ utils::formatToAspectMask(format) }, arrayLayers{ std::max(arrayLayers, 1u) }, samples{ samples }, _requestedMipLevels{ mipLevels }, _createFlags{ createFlags },
+    _tiling{ tiling }, _usageFlags{ usageFlags }, _memoryRequest{ memoryRequest }, _tag{ tag }, _exportable{ exportable }
 {
-    resize(extent);
+    if (samples != vk::SampleCountFlagBits::e1 && mipLevels != 1) throw std::invalid_argument{ "Multisampled images have a single mip" };
+    // the mip chain is filled with blits
+    if (mipLevels != 1) _usageFlags |= vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    if (allocateMemory) resize(extent);
+    else createImage(extent);
 
     //imageViewAddressProperties = imageView.getAddressNVX();
 
@@ -188,37 +719,145 @@ Image::Image(
     //}
 }
 
-void Image::resize(vk::Extent3D ex)
+Image::Image(
+    const evk::SharedPtr<Device>& device,
+    const ImportHandle importHandle,
+    const vk::Extent3D extent,
+    const vk::Format format,
+    const vk::ImageTiling tiling,
+    const vk::ImageUsageFlags usageFlags,
+    const vk::MemoryPropertyFlags memoryPropertyFlags,
+    const std::string_view tag,
+    const uint32_t mipLevels,
+    const uint32_t arrayLayers,
+    const vk::ImageCreateFlags createFlags
+) : Resource{ device }, image{ nullptr }, imageView{ nullptr }, format{ format },
+    aspectMask{ utils::formatToAspectMask(format) }, arrayLayers{ std::max(arrayLayers, 1u) }, _requestedMipLevels{ mipLevels }, _createFlags{ createFlags },
+    _tiling{ tiling }, _usageFlags{ usageFlags }, _memoryRequest{ memoryPropertyFlags, {}, {} }, _tag{ tag }, _imported{ true }, externalHandle{ importHandle.handle }
+{
+    if (mipLevels != 1) _usageFlags |= vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    // the image is created once, already chained with the external memory info the import needs
+    resize(extent);
+}
+
+void Image::resize(const vk::Extent3D ex)
 {
-    const vk::ImageType imageType = utils::extentToImageType(ex);
-    const vk::ImageViewType imageViewType = utils::extentToImageViewType(ex);
+    if (_imported && memory) throw std::runtime_error{ "Images importing memory can not be resized" };
+    createImage(ex);
+    const auto memoryRequirements = dev->getImageMemoryRequirements2({ *image }).memoryRequirements;
+    const uint32_t memoryTypeIndex = dev->selectMemoryType(memoryRequirements, _memoryRequest);
+    if (_exportable || _imported) {
+        // shared memory is a whole allocation dedicated to the image on both sides
+        constexpr vk::ExportMemoryAllocateInfo exportInfo{ externalMemoryHandleType };
+        const ImportMemoryInfo importInfo{ externalMemoryHandleType, externalHandle };
+        const vk::MemoryDedicatedAllocateInfo dedicatedInfo{ *image, {}, _imported ? static_cast<const void*>(&importInfo) : &exportInfo };
+        memory = dev->allocator->allocateDedicated(memoryRequirements, memoryTypeIndex, &dedicatedInfo, _tag);
+    }
+    else if (const auto lazyTypeIndex = _usageFlags & vk::ImageUsageFlagBits::eTransientAttachment ?
+        dev->findMemoryTypeIndex(memoryRequirements, vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated) : std::nullopt) {
+        // tilers only commit lazily allocated memory if the attachment ever has to leave tile memory, each image gets its own
+        memory = dev->allocator->allocateDedicated(memoryRequirements, lazyTypeIndex.value(), nullptr, _tag);
+    }
+    else memory = dev->allocator->allocate(memoryRequirements, memoryTypeIndex, _tiling == vk::ImageTiling::eOptimal, _tag);
+    bindMemory(*memory, memory.offset);
+    if (_exportable) externalHandle = exportMemory(*dev, *memory);
+}
+
+void Image::createImage(const vk::Extent3D ex)
+{
+    _views.clear();
+    imageView.clear();
+    image.clear();
+    memory = {};
 
+    const vk::ImageType imageType = utils::extentToImageType(ex);
+    _imageViewType = utils::extentToImageViewType(ex);
+    if (arrayLayers > 1u) {
+        const bool cube = (_createFlags & vk::ImageCreateFlagBits::eCubeCompatible) && arrayLayers % 6u == 0u;
+        if (cube) _imageViewType = arrayLayers == 6u ? vk::ImageViewType::eCube : vk::ImageViewType::eCubeArray;
+        else if (_imageViewType == vk::ImageViewType::e1D) _imageViewType = vk::ImageViewType::e1DArray;
+        else if (_imageViewType == vk::ImageViewType::e2D) _imageViewType = vk::ImageViewType::e2DArray;
+    }
     extent = ex;
     if (extent.height == 0) extent.height = 1;
     if (extent.depth == 0) extent.depth = 1;
-    const vk::ImageCreateInfo imageCreateInfo{ {}, imageType, format, extent,
-        1, 1, vk::SampleCountFlagBits::e1, _tiling,
+    // the requested count is kept so a resized full chain image gets the full chain of its new extent
+    mipLevels = _requestedMipLevels == 0 ? fullMipCount(extent) : std::min(_requestedMipLevels, fullMipCount(extent));
+    _createInfo = vk::ImageCreateInfo{ _createFlags, imageType, format, extent,
+        mipLevels, arrayLayers, samples, _tiling,
         _usageFlags
     };
-    image = vk::raii::Image{ *dev, imageCreateInfo };
-    const auto memoryRequirements = dev->getImageMemoryRequirements2({ *image }).memoryRequirements;
-    const auto memoryTypeIndex = dev->findMemoryTypeIndex(memoryRequirements, _memoryPropertyFlags);
-    if (!memoryTypeIndex.has_value()) throw std::runtime_error{ "No memory type index found" };
-    constexpr vk::MemoryAllocateFlagsInfo memoryAllocateFlagsInfo{ vk::MemoryAllocateFlagBits::eDeviceAddress };
-    const vk::MemoryAllocateInfo memoryAllocateInfo{ memoryRequirements.size, memoryTypeIndex.value(), &memoryAllocateFlagsInfo };
-    memory = vk::raii::DeviceMemory{ *dev, memoryAllocateInfo };
-    image.bindMemory(*memory, 0);
+    const vk::ExternalMemoryImageCreateInfo externalImageInfo{ externalMemoryHandleType };
+    image = vk::raii::Image{ *dev, vk::ImageCreateInfo{ _createInfo }.setPNext(_exportable || _imported ? &externalImageInfo : nullptr) };
+}
+
+void Image::bindMemory(const vk::DeviceMemory deviceMemory, const vk::DeviceSize offset)
+{
+    image.bindMemory(deviceMemory, offset);
 
-    imageView = vk::raii::ImageView{ *dev, vk::ImageViewCreateInfo{ {}, *image, imageViewType, format,
-        {}, { aspectMask, 0, 1, 0, 1 } } };
+    imageView = vk::raii::ImageView{ *dev, vk::ImageViewCreateInfo{ {}, *image, _imageViewType, format,
+        {}, { aspectMask, 0, mipLevels, 0, arrayLayers } } };
     barrier.oldLayout = vk::ImageLayout::eUndefined;
     barrier.image = *image;
-    barrier.subresourceRange = { aspectMask, 0, 1, 0, 1 };
+    barrier.subresourceRange = { aspectMask, 0, mipLevels, 0, arrayLayers };
+}
+
+vk::ImageView Image::view(const uint32_t mipLevel, const uint32_t layer)
+{
+    if (mipLevel >= mipLevels || (layer != allLayers && layer >= arrayLayers)) throw std::out_of_range{ "Image subresource out of range" };
+    const uint64_t key = static_cast<uint64_t>(mipLevel) << 32u | layer;
+    if (const auto it = _views.find(key); it != _views.end()) return *it->second;
+
+    vk::ImageViewType viewType = _imageViewType;
+    if (layer != allLayers) viewType = _createInfo.imageType == vk::ImageType::e1D ? vk::ImageViewType::e1D : _createInfo.imageType == vk::ImageType::e3D ? vk::ImageViewType::e3D : vk::ImageViewType::e2D;
+    const vk::ImageSubresourceRange range{ aspectMask, mipLevel, 1, layer == allLayers ? 0 : layer, layer == allLayers ? arrayLayers : 1 };
+    return *_views.emplace(key, vk::raii::ImageView{ *dev, vk::ImageViewCreateInfo{ {}, *image, viewType, format, {}, range } }).first->second;
+}
+
+void Image::cmdGenerateMips(const vk::raii::CommandBuffer& cb, const vk::ImageLayout finalLayout)
+{
+    const vk::FormatFeatureFlags features = dev->physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+    if (!(features & vk::FormatFeatureFlagBits::eBlitSrc) || !(features & vk::FormatFeatureFlagBits::eBlitDst)) throw std::runtime_error{ "Format does not support blits" };
+    const vk::Filter filter = features & vk::FormatFeatureFlagBits::eSampledImageFilterLinear ? vk::Filter::eLinear : vk::Filter::eNearest;
+    const auto level = [this](const uint32_t mip) { return vk::ImageSubresourceRange{ aspectMask, mip, 1, 0, arrayLayers }; };
+    const auto mipOffset = [this](const uint32_t mip) {
+        return vk::Offset3D{ static_cast<int32_t>(std::max(extent.width >> mip, 1u)), static_cast<int32_t>(std::max(extent.height >> mip, 1u)), static_cast<int32_t>(std::max(extent.depth >> mip, 1u)) };
+    };
+
+    // mip 0 becomes the first blit source, the rest is overwritten
+    std::vector<vk::ImageMemoryBarrier2> barriers{
+        { vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferRead,
+            barrier.oldLayout, vk::ImageLayout::eTransferSrcOptimal, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image, level(0) }
+    };
+    if (mipLevels > 1u) barriers.emplace_back(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferWrite,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image, vk::ImageSubresourceRange{ aspectMask, 1, mipLevels - 1u, 0, arrayLayers });
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(barriers));
+
+    for (uint32_t mip = 1; mip < mipLevels; mip++) {
+        const vk::ImageBlit blit{ { aspectMask, mip - 1u, 0, arrayLayers }, { vk::Offset3D{}, mipOffset(mip - 1u) }, { aspectMask, mip, 0, arrayLayers }, { vk::Offset3D{}, mipOffset(mip) } };
+        cb.blitImage(*image, vk::ImageLayout::eTransferSrcOptimal, *image, vk::ImageLayout::eTransferDstOptimal, blit, filter);
+        const vk::ImageMemoryBarrier2 toSrc{ vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferRead,
+            vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image, level(mip) };
+        cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(toSrc));
+    }
+
+    const vk::ImageMemoryBarrier2 toFinal{ vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferRead | vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+        vk::ImageLayout::eTransferSrcOptimal, finalLayout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image, barrier.subresourceRange };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(toFinal));
+    barrier.oldLayout = finalLayout;
+}
+
+vk::RenderingAttachmentInfo Image::resolveAttachment(const Image& resolveTarget, const vk::ClearValue& clearValue, vk::ResolveModeFlagBits resolveMode) const
+{
+    if (samples == vk::SampleCountFlagBits::e1) throw std::runtime_error{ "Only multisampled images can be resolved" };
+    if (resolveMode == vk::ResolveModeFlagBits::eNone) resolveMode = aspectMask & vk::ImageAspectFlagBits::eColor ? vk::ResolveModeFlagBits::eAverage : vk::ResolveModeFlagBits::eSampleZero;
+    return { *imageView, vk::ImageLayout::eAttachmentOptimal, resolveMode, *resolveTarget.imageView, vk::ImageLayout::eAttachmentOptimal,
+        vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eDontCare, clearValue };
 }
 
 void Image::transitionLayout(const vk::ImageLayout newLayout)
 {
-    const vk::ImageSubresourceRange imageSubresourceRange{ aspectMask, 0, 1, 0, 1 };
+    const vk::ImageSubresourceRange imageSubresourceRange{ aspectMask, 0, mipLevels, 0, arrayLayers };
     const vk::HostImageLayoutTransitionInfo hostImageLayoutTransitionInfo{ *image, barrier.oldLayout, newLayout, imageSubresourceRange };
     dev->transitionImageLayout(hostImageLayoutTransitionInfo);
     barrier.oldLayout = newLayout;
@@ -227,7 +866,7 @@ void Image::copyMemoryToImage(const void* ptr) const
 {
     const auto memoryToImageCopy = vk::MemoryToImageCopy{ ptr }
         .setImageExtent(extent)
-        .setImageSubresource({ aspectMask, 0, 0, 1 });
+        .setImageSubresource({ aspectMask, 0, 0, arrayLayers });
     const vk::CopyMemoryToImageInfo copyMemoryToImageInfo{ {}, *image, barrier.oldLayout, memoryToImageCopy };
     dev->copyMemoryToImage(copyMemoryToImageInfo);
 }
@@ -235,10 +874,160 @@ void Image::copyImageToMemory(void* ptr) const
 {
     const auto imageToMemoryCopy = vk::ImageToMemoryCopy{ ptr }
         .setImageExtent(extent)
-        .setImageSubresource({ aspectMask, 0, 0, 1 });
+        .setImageSubresource({ aspectMask, 0, 0, arrayLayers });
     const vk::CopyImageToMemoryInfo copyImageToMemoryInfo{ {}, *image, barrier.oldLayout, imageToMemoryCopy };
     dev->copyImageToMemory(copyImageToMemoryInfo);
 }
+void Image::copyMemoryToImage(const void* ptr, const std::span<const Region> regions) const
+{
+    std::vector<vk::MemoryToImageCopy> copies;
+    copies.reserve(regions.size());
+    for (const auto& r : regions) {
+        copies.emplace_back(static_cast<const std::byte*>(ptr) + r.memoryOffset, r.memoryRowLength, r.memoryImageHeight,
+            vk::ImageSubresourceLayers{ aspectMask, r.mipLevel, r.baseArrayLayer, r.layerCount }, r.offset, r.extent);
+    }
+    dev->copyMemoryToImage(vk::CopyMemoryToImageInfo{ {}, *image, barrier.oldLayout, copies });
+}
+void Image::copyImageToMemory(void* ptr, const std::span<const Region> regions) const
+{
+    std::vector<vk::ImageToMemoryCopy> copies;
+    copies.reserve(regions.size());
+    for (const auto& r : regions) {
+        copies.emplace_back(static_cast<std::byte*>(ptr) + r.memoryOffset, r.memoryRowLength, r.memoryImageHeight,
+            vk::ImageSubresourceLayers{ aspectMask, r.mipLevel, r.baseArrayLayer, r.layerCount }, r.offset, r.extent);
+    }
+    dev->copyImageToMemory(vk::CopyImageToMemoryInfo{ {}, *image, barrier.oldLayout, copies });
+}
+
+OwnershipTransfer::OwnershipTransfer(
+    const Device::QueueFamily srcQueueFamily,
+    const Device::QueueFamily dstQueueFamily,
+    const vk::PipelineStageFlags2 srcStageMask,
+    const vk::AccessFlags2 srcAccessMask,
+    const vk::PipelineStageFlags2 dstStageMask,
+    const vk::AccessFlags2 dstAccessMask
+) : srcQueueFamily{ srcQueueFamily }, dstQueueFamily{ dstQueueFamily }, srcStageMask{ srcStageMask }, dstStageMask{ dstStageMask },
+    srcAccessMask{ srcAccessMask }, dstAccessMask{ dstAccessMask } {}
+
+OwnershipTransfer& OwnershipTransfer::add(const Buffer& buffer)
+{
+    if (srcQueueFamily == dstQueueFamily) {
+        bufferReleases.emplace_back(srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *buffer.buffer, 0, vk::WholeSize);
+        return *this;
+    }
+    // the destination half of a release and the source half of an acquire are ignored
+    bufferReleases.emplace_back(srcStageMask, srcAccessMask, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, srcQueueFamily, dstQueueFamily, *buffer.buffer, 0, vk::WholeSize);
+    bufferAcquires.emplace_back(vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, dstStageMask, dstAccessMask, srcQueueFamily, dstQueueFamily, *buffer.buffer, 0, vk::WholeSize);
+    return *this;
+}
+
+OwnershipTransfer& OwnershipTransfer::add(Image& image, const std::optional<vk::ImageLayout> newLayout)
+{
+    const vk::ImageLayout oldLayout = image.barrier.oldLayout;
+    const vk::ImageLayout layout = newLayout.value_or(oldLayout);
+    const auto range = image.barrier.subresourceRange;
+    image.barrier.oldLayout = layout;
+    if (srcQueueFamily == dstQueueFamily) {
+        imageReleases.emplace_back(srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, oldLayout, layout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image.image, range);
+        return *this;
+    }
+    imageReleases.emplace_back(srcStageMask, srcAccessMask, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, oldLayout, layout, srcQueueFamily, dstQueueFamily, *image.image, range);
+    imageAcquires.emplace_back(vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, dstStageMask, dstAccessMask, oldLayout, layout, srcQueueFamily, dstQueueFamily, *image.image, range);
+    return *this;
+}
+
+void OwnershipTransfer::cmdRelease(const vk::raii::CommandBuffer& cb) const
+{
+    if (bufferReleases.empty() && imageReleases.empty()) return;
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(bufferReleases).setImageMemoryBarriers(imageReleases));
+}
+
+void OwnershipTransfer::cmdAcquire(const vk::raii::CommandBuffer& cb) const
+{
+    if (bufferAcquires.empty() && imageAcquires.empty()) return;
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(bufferAcquires).setImageMemoryBarriers(imageAcquires));
+}
+
+BarrierBatch& BarrierBatch::add(const vk::ImageMemoryBarrier2& barrier)
+{
+    for (auto& pending : imageBarriers) {
+        if (pending.image != barrier.image || pending.subresourceRange != barrier.subresourceRange) continue;
+        if (pending.srcQueueFamilyIndex != barrier.srcQueueFamilyIndex || pending.dstQueueFamilyIndex != barrier.dstQueueFamilyIndex) continue;
+        const bool repeats = pending.oldLayout == barrier.oldLayout && pending.newLayout == barrier.newLayout;
+        if (!repeats && pending.newLayout != barrier.oldLayout) continue;
+        pending.newLayout = barrier.newLayout;
+        pending.srcStageMask |= barrier.srcStageMask;
+        pending.srcAccessMask |= barrier.srcAccessMask;
+        pending.dstStageMask |= barrier.dstStageMask;
+        pending.dstAccessMask |= barrier.dstAccessMask;
+        return *this;
+    }
+    imageBarriers.push_back(barrier);
+    return *this;
+}
+
+BarrierBatch& BarrierBatch::add(const vk::BufferMemoryBarrier2& barrier)
+{
+    for (auto& pending : bufferBarriers) {
+        if (pending.buffer != barrier.buffer || pending.offset != barrier.offset || pending.size != barrier.size) continue;
+        if (pending.srcQueueFamilyIndex != barrier.srcQueueFamilyIndex || pending.dstQueueFamilyIndex != barrier.dstQueueFamilyIndex) continue;
+        pending.srcStageMask |= barrier.srcStageMask;
+        pending.srcAccessMask |= barrier.srcAccessMask;
+        pending.dstStageMask |= barrier.dstStageMask;
+        pending.dstAccessMask |= barrier.dstAccessMask;
+        return *this;
+    }
+    bufferBarriers.push_back(barrier);
+    return *this;
+}
+
+BarrierBatch& BarrierBatch::add(const vk::MemoryBarrier2& barrier)
+{
+    if (!memoryBarrier) {
+        memoryBarrier = vk::MemoryBarrier2{ barrier.srcStageMask, barrier.srcAccessMask, barrier.dstStageMask, barrier.dstAccessMask };
+        return *this;
+    }
+    memoryBarrier->srcStageMask |= barrier.srcStageMask;
+    memoryBarrier->srcAccessMask |= barrier.srcAccessMask;
+    memoryBarrier->dstStageMask |= barrier.dstStageMask;
+    memoryBarrier->dstAccessMask |= barrier.dstAccessMask;
+    return *this;
+}
+
+BarrierBatch& BarrierBatch::add(
+    const Buffer& buffer,
+    const vk::PipelineStageFlags2 srcStageMask,
+    const vk::AccessFlags2 srcAccessMask,
+    const vk::PipelineStageFlags2 dstStageMask,
+    const vk::AccessFlags2 dstAccessMask)
+{
+    return add(vk::BufferMemoryBarrier2{ srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *buffer.buffer, 0, vk::WholeSize });
+}
+
+BarrierBatch& BarrierBatch::transition(
+    Image& image,
+    const vk::ImageLayout newLayout,
+    const vk::PipelineStageFlags2 srcStageMask,
+    const vk::AccessFlags2 srcAccessMask,
+    const vk::PipelineStageFlags2 dstStageMask,
+    const vk::AccessFlags2 dstAccessMask)
+{
+    add(vk::ImageMemoryBarrier2{ srcStageMask, srcAccessMask, dstStageMask, dstAccessMask, image.barrier.oldLayout, newLayout,
+        vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image.image, image.barrier.subresourceRange });
+    image.barrier.oldLayout = newLayout;
+    return *this;
+}
+
+void BarrierBatch::flush(const vk::raii::CommandBuffer& cb)
+{
+    if (empty()) return;
+    auto dependencyInfo = vk::DependencyInfo{}.setBufferMemoryBarriers(bufferBarriers).setImageMemoryBarriers(imageBarriers);
+    if (memoryBarrier) dependencyInfo.setMemoryBarriers(*memoryBarrier);
+    cb.pipelineBarrier2(dependencyInfo);
+    imageBarriers.clear();
+    bufferBarriers.clear();
+    memoryBarrier.reset();
+}
 
 DescriptorSetLayout::DescriptorSetLayout(
     const evk::SharedPtr<Device>& device,
@@ -356,3 +1145,902 @@ ShaderObject::ShaderObject(
     _shaders = dev->createShadersEXT(shaderCreateInfos);
     for (size_t i = 0; i < shaderStages.size(); ++i) shaders[i] = *_shaders[i]; // needed in order to pass the vector directly to bindShadersEXT()
 }
+
+ParallelRecorder::ParallelRecorder(const evk::SharedPtr<Device>& device, const Device::QueueFamily queueFamily) : Resource{ device }, queueFamily{ queueFamily } {}
+
+ParallelRecorder::FrameId ParallelRecorder::beginFrame()
+{
+    std::scoped_lock lock{ _mutex };
+    return _frames.begin();
+}
+
+void ParallelRecorder::beginFrame(Swapchain::Frame& frame)
+{
+    std::scoped_lock lock{ _mutex };
+    _frames.begin(frame, [this](const FrameId id) { retire(id); });
+}
+
+void ParallelRecorder::retire(const FrameId id)
+{
+    std::scoped_lock lock{ _mutex };
+    _frames.retire(id);
+}
+
+const vk::raii::CommandBuffer& ParallelRecorder::begin(const uint32_t order, const vk::CommandBufferInheritanceRenderingInfo* rendering)
+{
+    Slot* slot;
+    FrameId tag, oldestInFlight;
+    {
+        std::scoped_lock lock{ _mutex };
+        auto& entry = _slots[std::this_thread::get_id()];
+        if (!entry) entry = std::make_unique<Slot>(CommandPool{ dev, queueFamily });
+        slot = entry.get();
+        tag = _frames.next();
+        oldestInFlight = _frames.oldest();
+    }
+    // buffers tagged up to the oldest frame in flight were only used by retired frames
+    while (!slot->used.empty() && slot->used.front().first <= oldestInFlight) {
+        slot->pool.release(std::move(slot->used.front().second), nullptr, vk::CommandBufferLevel::eSecondary);
+        slot->used.pop_front();
+    }
+
+    const auto& cb = slot->used.emplace_back(tag, slot->pool.acquire(vk::CommandBufferLevel::eSecondary)).second;
+    const auto inheritance = vk::CommandBufferInheritanceInfo{}.setPNext(rendering);
+    auto usage = vk::CommandBufferUsageFlags{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit };
+    if (rendering) usage |= vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    cb.begin({ usage, &inheritance });
+
+    std::scoped_lock lock{ _mutex };
+    _recorded.emplace_back(order, *cb);
+    return cb;
+}
+
+void ParallelRecorder::record(utils::ThreadPool& pool, const uint32_t count, const Job& job, const vk::CommandBufferInheritanceRenderingInfo* rendering)
+{
+    pool.parallelFor(count, [&](const uint32_t i) {
+        const auto& cb = begin(i, rendering);
+        job(i, cb);
+        cb.end();
+    });
+}
+
+void ParallelRecorder::cmdExecute(const vk::raii::CommandBuffer& primary)
+{
+    std::scoped_lock lock{ _mutex };
+    if (_recorded.empty()) return;
+    std::ranges::stable_sort(_recorded, {}, &std::pair<uint32_t, vk::CommandBuffer>::first);
+    std::vector<vk::CommandBuffer> commandBuffers;
+    commandBuffers.reserve(_recorded.size());
+    for (const auto& [order, cb] : _recorded) commandBuffers.push_back(cb);
+    primary.executeCommands(commandBuffers);
+    _recorded.clear();
+}
+
+TransientAllocator::TransientAllocator(
+    const evk::SharedPtr<Device>& device,
+    const vk::DeviceSize size,
+    const vk::BufferUsageFlags usageFlags
+) : Resource{ device }, buffer{ device, size, usageFlags, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, false, false, "transient" },
+    _mapped{ buffer.data().data() },
+    _alignment{ std::max(dev->properties.limits.minUniformBufferOffsetAlignment, dev->properties.limits.minStorageBufferOffsetAlignment) } {}
+
+TransientAllocator::FrameId TransientAllocator::beginFrame()
+{
+    const FrameId id = _frames.begin();
+    _frameEnds.emplace_back(id, _head);
+    return id;
+}
+
+void TransientAllocator::beginFrame(Swapchain::Frame& frame)
+{
+    _frameEnds.emplace_back(_frames.begin(frame, [this](const FrameId id) { retire(id); }), _head);
+}
+
+void TransientAllocator::retire(const FrameId id)
+{
+    // frames may retire out of order, only release memory up to the oldest frame still in flight
+    if (!_frames.retire(id)) return;
+    while (!_frameEnds.empty() && _frames.retiredBefore(_frameEnds.front().first + 1u)) {
+        _tail = _frameEnds.front().second;
+        _frameEnds.pop_front();
+    }
+}
+
+TransientAllocator::Slice TransientAllocator::allocate(const vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    if (_frameEnds.empty()) throw std::runtime_error{ "TransientAllocator::beginFrame must be called before allocating" };
+    if (!alignment) alignment = _alignment;
+    const vk::DeviceSize capacity = buffer.size;
+
+    const vk::DeviceSize physical = _head % capacity;
+    vk::DeviceSize aligned = utils::roundUpToMultipleOf(physical, alignment);
+    vk::DeviceSize offset = _head - physical + aligned;
+    if (aligned + size > capacity) { // does not fit before the end, wrap around to the start
+        aligned = 0;
+        offset = _head - physical + capacity;
+    }
+    if (offset + size - _tail > capacity) throw std::runtime_error{ "TransientAllocator is out of memory" };
+
+    _head = offset + size;
+    _frameEnds.back().second = _head;
+    return { _mapped + aligned, *buffer.buffer, aligned, size, buffer.deviceAddress ? buffer.deviceAddress + aligned : 0 };
+}
+
+ImagePool::FrameId ImagePool::beginFrame()
+{
+    return _frames.begin();
+}
+
+void ImagePool::beginFrame(Swapchain::Frame& frame)
+{
+    _frames.begin(frame, [this](const FrameId id) { retire(id); });
+}
+
+void ImagePool::retire(const FrameId id)
+{
+    _frames.retire(id);
+}
+
+bool ImagePool::_available(const evk::SharedPtr<Image>& image, const FrameId lastFrame) const
+{
+    // the pool holds the only reference and every frame that could have used the image is retired
+    return image->refCount == 1 && _frames.retiredBefore(lastFrame);
+}
+
+evk::SharedPtr<Image> ImagePool::acquire(const Desc& desc)
+{
+    for (auto& entry : _images) {
+        if (entry.desc != desc || !_available(entry.image, entry.lastFrame)) continue;
+        entry.lastFrame = _frames.next();
+        return entry.image;
+    }
+    auto& entry = _images.emplace_back(desc, evk::make_shared<Image>(dev, desc.extent, desc.format, desc.tiling, desc.usageFlags, desc.memoryPropertyFlags, true, std::string_view{}, desc.mipLevels, desc.arrayLayers, vk::ImageCreateFlags{}, false, desc.samples), _frames.next());
+    return entry.image;
+}
+
+std::vector<evk::SharedPtr<Image>> ImagePool::acquireTransient(const std::vector<TransientDesc>& descs)
+{
+    const auto handOut = [this](AliasSet& set) {
+        set.lastFrame = _frames.next();
+        for (auto& image : set.images) image->barrier.oldLayout = vk::ImageLayout::eUndefined;
+        return set.images;
+    };
+    for (auto& set : _aliasSets) {
+        if (set->descs != descs) continue;
+        if (!std::ranges::all_of(set->images, [&](const auto& image) { return _available(image, set->lastFrame); })) continue;
+        return handOut(*set);
+    }
+
+    auto set = std::make_unique<AliasSet>();
+    set->descs = descs;
+    std::vector<vk::MemoryRequirements> requirements;
+    vk::MemoryPropertyFlags memoryPropertyFlags;
+    uint32_t memoryTypeBits = ~0u;
+    vk::DeviceSize alignment = 1;
+    for (const auto& [desc, firstPass, lastPass] : descs) {
+        if (desc.tiling != vk::ImageTiling::eOptimal) throw std::runtime_error{ "Transient images must use optimal tiling" };
+        auto& image = set->images.emplace_back(evk::make_shared<Image>(dev, desc.extent, desc.format, desc.tiling, desc.usageFlags, desc.memoryPropertyFlags, false, std::string_view{}, desc.mipLevels, desc.arrayLayers, vk::ImageCreateFlags{}, false, desc.samples));
+        requirements.push_back(dev->getImageMemoryRequirements2({ *image->image }).memoryRequirements);
+        memoryPropertyFlags |= desc.memoryPropertyFlags;
+        memoryTypeBits &= requirements.back().memoryTypeBits;
+        alignment = std::max(alignment, requirements.back().alignment);
+    }
+
+    // place the largest images first, an image only has to avoid the memory of images whose pass ranges overlap its own
+    std::vector<size_t> order(descs.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::ranges::stable_sort(order, [&](const size_t a, const size_t b) { return requirements[a].size > requirements[b].size; });
+    std::vector<vk::DeviceSize> offsets(descs.size());
+    std::vector<size_t> placed;
+    vk::DeviceSize totalSize = 0;
+    for (const size_t i : order) {
+        std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>> occupied;
+        for (const size_t j : placed) {
+            if (descs[i].firstPass <= descs[j].lastPass && descs[j].firstPass <= descs[i].lastPass) occupied.emplace_back(offsets[j], offsets[j] + requirements[j].size);
+        }
+        std::ranges::sort(occupied);
+        vk::DeviceSize offset = 0;
+        for (const auto& [begin, end] : occupied) {
+            if (offset + requirements[i].size <= begin) break;
+            offset = std::max(offset, utils::roundUpToMultipleOf(end, requirements[i].alignment));
+        }
+        offsets[i] = offset;
+        totalSize = std::max(totalSize, offset + requirements[i].size);
+        placed.push_back(i);
+    }
+
+    const uint32_t memoryTypeIndex = dev->selectMemoryType({ totalSize, alignment, memoryTypeBits }, memoryPropertyFlags);
+    set->memory = dev->allocator->allocateDedicated({ totalSize, alignment, memoryTypeBits }, memoryTypeIndex, nullptr, "transient_images");
+    for (size_t i = 0; i < descs.size(); i++) set->images[i]->bindMemory(*set->memory, set->memory.offset + offsets[i]);
+
+    return handOut(*_aliasSets.emplace_back(std::move(set)));
+}
+
+void ImagePool::trim()
+{
+    std::erase_if(_images, [&](const Entry& entry) { return _available(entry.image, entry.lastFrame); });
+    std::erase_if(_aliasSets, [&](const std::unique_ptr<AliasSet>& set) {
+        return std::ranges::all_of(set->images, [&](const auto& image) { return _available(image, set->lastFrame); });
+    });
+}
+
+TimelineSemaphore::TimelineSemaphore(const evk::SharedPtr<Device>& device, const uint64_t initialValue, const bool exportable) :
+    Resource{ device }, semaphore{ nullptr }, _exportable{ exportable }
+{
+    const vk::ExportSemaphoreCreateInfo exportInfo{ externalSemaphoreHandleType };
+    const vk::SemaphoreTypeCreateInfo semaphoreTypeCreateInfo{ vk::SemaphoreType::eTimeline, initialValue, exportable ? &exportInfo : nullptr };
+    semaphore = vk::raii::Semaphore{ *dev, vk::SemaphoreCreateInfo{ {}, &semaphoreTypeCreateInfo } };
+}
+
+TimelineSemaphore::TimelineSemaphore(const evk::SharedPtr<Device>& device, const ImportHandle importHandle) : TimelineSemaphore{ device }
+{
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+    dev->importSemaphoreWin32HandleKHR({ *semaphore, {}, externalSemaphoreHandleType, importHandle.handle });
+#else
+    dev->importSemaphoreFdKHR({ *semaphore, {}, externalSemaphoreHandleType, importHandle.handle });
+#endif
+}
+
+ExternalHandle TimelineSemaphore::exportHandle() const
+{
+    if (!_exportable) throw std::runtime_error{ "Semaphore is not exportable" };
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+    return (ExternalHandle)dev->getSemaphoreWin32HandleKHR({ *semaphore, externalSemaphoreHandleType });
+#else
+    return (ExternalHandle)dev->getSemaphoreFdKHR({ *semaphore, externalSemaphoreHandleType });
+#endif
+}
+
+void TimelineSemaphore::signal(const uint64_t value) const
+{
+    dev->signalSemaphore(vk::SemaphoreSignalInfo{ *semaphore, value });
+}
+
+bool TimelineSemaphore::wait(const uint64_t value, const uint64_t timeout) const
+{
+    return dev->waitSemaphores(vk::SemaphoreWaitInfo{ {}, *semaphore, value }, timeout) == vk::Result::eSuccess;
+}
+
+SharedImageRing::SharedImageRing(
+    const evk::SharedPtr<Device>& device,
+    const uint32_t slotCount,
+    const vk::Extent3D extent,
+    const vk::Format format,
+    const vk::ImageUsageFlags usageFlags
+) : Resource{ device }, producer{ true }
+{
+    if (slotCount == 0) throw std::invalid_argument{ "Ring needs at least one slot" };
+    for (uint32_t i = 0; i < slotCount; i++) {
+        images.push_back(evk::make_shared<Image>(dev, extent, format, vk::ImageTiling::eOptimal, usageFlags, vk::MemoryPropertyFlagBits::eDeviceLocal,
+            true, "shared_ring", 1, 1, vk::ImageCreateFlags{}, true));
+    }
+    produced = evk::make_shared<TimelineSemaphore>(dev, 0, true);
+    consumed = evk::make_shared<TimelineSemaphore>(dev, 0, true);
+}
+
+SharedImageRing::SharedImageRing(
+    const evk::SharedPtr<Device>& device,
+    const Handles& handles,
+    const vk::Extent3D extent,
+    const vk::Format format,
+    const vk::ImageUsageFlags usageFlags
+) : Resource{ device }, producer{ false }
+{
+    if (handles.images.empty()) throw std::invalid_argument{ "Ring needs at least one slot" };
+    for (const ExternalHandle handle : handles.images) {
+        images.push_back(evk::make_shared<Image>(dev, ImportHandle{ handle }, extent, format, vk::ImageTiling::eOptimal, usageFlags, vk::MemoryPropertyFlagBits::eDeviceLocal, "shared_ring"));
+    }
+    produced = evk::make_shared<TimelineSemaphore>(dev, ImportHandle{ handles.produced });
+    consumed = evk::make_shared<TimelineSemaphore>(dev, ImportHandle{ handles.consumed });
+}
+
+SharedImageRing::Handles SharedImageRing::exportHandles() const
+{
+    if (!producer) throw std::runtime_error{ "Only the producer exports the ring" };
+    Handles handles{ {}, produced->exportHandle(), consumed->exportHandle() };
+    // the images exported their memory when it was allocated, the consumer gets its own copy of those handles
+    for (const auto& image : images) handles.images.push_back(duplicateHandle(image->externalHandle));
+    return handles;
+}
+
+SharedImageRing::Slot SharedImageRing::next(const vk::PipelineStageFlags2 stage)
+{
+    const uint64_t frame = _frame++;
+    const uint64_t slotCount = images.size();
+    const auto index = static_cast<uint32_t>(frame % slotCount);
+    // the producer reuses a slot once the frame written into it a lap earlier was consumed
+    if (producer) return { index, frame, images[index].get(), consumed->submitInfo(frame >= slotCount ? frame + 1u - slotCount : 0u, stage), produced->submitInfo(frame + 1u) };
+    return { index, frame, images[index].get(), produced->submitInfo(frame + 1u, stage), consumed->submitInfo(frame + 1u) };
+}
+
+void SharedImageRing::skipToLatest()
+{
+    if (producer) throw std::runtime_error{ "Only the consumer skips frames" };
+    const uint64_t latest = produced->value();
+    if (latest > _frame + 1u) _frame = latest - 1u;
+}
+
+void SharedImageRing::cmdAcquire(const vk::raii::CommandBuffer& cb, const Slot& slot, const Device::QueueFamily queueFamily, const vk::ImageLayout layout) const
+{
+    // during the producer's first lap the image was never released, so there is nothing to acquire
+    const bool firstUse = producer && slot.frame < images.size();
+    const vk::ImageMemoryBarrier2 acquire{ vk::PipelineStageFlagBits2::eNone, {}, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+        firstUse ? vk::ImageLayout::eUndefined : vk::ImageLayout::eGeneral, layout,
+        firstUse ? vk::QueueFamilyIgnored : vk::QueueFamilyExternal, firstUse ? vk::QueueFamilyIgnored : queueFamily,
+        *slot.image->image, slot.image->barrier.subresourceRange };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(acquire));
+    slot.image->barrier.oldLayout = layout;
+}
+
+void SharedImageRing::cmdRelease(const vk::raii::CommandBuffer& cb, const Slot& slot, const Device::QueueFamily queueFamily, const vk::ImageLayout layout) const
+{
+    const vk::ImageMemoryBarrier2 release{ vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eNone, {},
+        layout, vk::ImageLayout::eGeneral, queueFamily, vk::QueueFamilyExternal, *slot.image->image, slot.image->barrier.subresourceRange };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(release));
+    slot.image->barrier.oldLayout = vk::ImageLayout::eGeneral;
+}
+
+UploadEngine::UploadEngine(
+    const evk::SharedPtr<Device>& device,
+    const Device::QueueFamily queueFamily,
+    const Device::QueueFamily dstQueueFamily,
+    const Device::QueueCount queueIndex,
+    const vk::DeviceSize chunkSize
+) : Resource{ device }, commandPool{ device, queueFamily, vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer },
+    queue{ &dev->getQueue(queueFamily, queueIndex) }, semaphore{ createTimelineSemaphore(*dev) },
+    queueFamily{ queueFamily }, dstQueueFamily{ dstQueueFamily }, chunkSize{ chunkSize },
+    _graphicsQueue{ static_cast<bool>(dev->physicalDevice.getQueueFamilyProperties()[queueFamily].queueFlags & vk::QueueFlagBits::eGraphics) } {}
+
+UploadEngine::~UploadEngine()
+{
+    if (!*semaphore) return;
+    wait(flush());
+}
+
+void UploadEngine::upload(const Buffer& dst, const void* src, const vk::DeviceSize byteSize, const vk::DeviceSize dstOffset)
+{
+    if (byteSize == 0) return;
+    if (dstOffset + byteSize > dst.size) throw std::out_of_range{ "Upload exceeds buffer size" };
+    std::scoped_lock lock{ _mutex };
+    _collect();
+    const auto& cb = _recording();
+    const auto [staging, offset] = _stage(src, byteSize, 16u);
+    cb.copyBuffer(*staging->buffer, *dst.buffer, vk::BufferCopy{ offset, dstOffset, byteSize });
+    // on the same queue family the semaphore signal/wait already makes the copy visible
+    if (queueFamily != dstQueueFamily) {
+        _batch->bufferReleases.emplace_back(vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone,
+            queueFamily, dstQueueFamily, *dst.buffer, dstOffset, byteSize);
+    }
+}
+
+void UploadEngine::upload(Image& dst, const void* src, const vk::ImageLayout finalLayout, const bool generateMips)
+{
+    const vk::DeviceSize texelBlockSize = vk::blockSize(dst.format);
+    // compressed formats can not be blitted, src holds every mip instead
+    const bool compressed = utils::isBlockCompressed(dst.format);
+    std::vector<vk::BufferImageCopy> copies;
+    vk::DeviceSize byteSize = 0;
+    for (uint32_t mip = 0; mip < (compressed ? dst.mipLevels : 1u); mip++) {
+        const vk::Extent3D mipExtent = dst.mipExtent(mip);
+        copies.emplace_back(byteSize, 0, 0, vk::ImageSubresourceLayers{ dst.aspectMask, mip, 0, dst.arrayLayers }, vk::Offset3D{}, mipExtent);
+        byteSize += utils::imageByteSize(mipExtent, dst.format) * dst.arrayLayers;
+    }
+    const vk::ImageSubresourceRange range = dst.barrier.subresourceRange;
+    const bool mips = generateMips && !compressed && dst.mipLevels > 1u;
+    if (mips && !_graphicsQueue && queueFamily == dstQueueFamily) throw std::runtime_error{ "Mips can not be generated without a graphics queue" };
+
+    std::scoped_lock lock{ _mutex };
+    _collect();
+    const auto& cb = _recording();
+    // bufferOffset has to be a multiple of 4 and of the texel block size
+    const auto [staging, offset] = _stage(src, byteSize, std::lcm(vk::DeviceSize{ 4 }, texelBlockSize));
+
+    const vk::ImageMemoryBarrier2 toTransfer{ vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *dst.image, range };
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(toTransfer));
+    for (auto& copy : copies) copy.bufferOffset += offset;
+    cb.copyBufferToImage(*staging->buffer, *dst.image, vk::ImageLayout::eTransferDstOptimal, copies);
+
+    vk::ImageLayout releaseLayout = vk::ImageLayout::eTransferDstOptimal;
+    vk::PipelineStageFlags2 releaseStage = vk::PipelineStageFlagBits2::eCopy;
+    vk::ImageLayout acquireLayout = finalLayout;
+    if (mips && _graphicsQueue) {
+        dst.barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        dst.cmdGenerateMips(cb, finalLayout);
+        if (queueFamily == dstQueueFamily) return;
+        releaseLayout = acquireLayout = finalLayout;
+        releaseStage = vk::PipelineStageFlagBits2::eAllCommands;
+    } else if (mips) {
+        // a transfer only queue can not blit, the chain is generated by cmdAcquire on the destination queue
+        acquireLayout = vk::ImageLayout::eTransferDstOptimal;
+        _batch->mips.emplace_back(&dst, finalLayout);
+    }
+
+    if (queueFamily != dstQueueFamily) {
+        _batch->imageReleases.emplace_back(releaseStage, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone,
+            releaseLayout, acquireLayout, queueFamily, dstQueueFamily, *dst.image, range);
+    } else {
+        _batch->imageReleases.emplace_back(vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+            vk::ImageLayout::eTransferDstOptimal, finalLayout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *dst.image, range);
+    }
+    dst.barrier.oldLayout = acquireLayout;
+}
+
+UploadEngine::Ticket UploadEngine::flush()
+{
+    std::scoped_lock lock{ _mutex };
+    _collect();
+    if (!_batch) return { _nextValue - 1u };
+
+    auto& batch = *_batch;
+    if (!batch.bufferReleases.empty() || !batch.imageReleases.empty()) {
+        batch.cb.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(batch.bufferReleases).setImageMemoryBarriers(batch.imageReleases));
+    }
+    batch.cb.end();
+    const vk::CommandBufferSubmitInfo commandBufferSubmitInfo{ *batch.cb };
+    const vk::SemaphoreSubmitInfo signal{ *semaphore, batch.value, vk::PipelineStageFlagBits2::eAllCommands };
+    queue->submit2(vk::SubmitInfo2{ {}, {}, commandBufferSubmitInfo, signal });
+
+    // the matching acquire repeats the release with the source half of the dependency left to the semaphore wait
+    if (queueFamily != dstQueueFamily) {
+        for (auto b : batch.bufferReleases) {
+            b.setSrcStageMask(vk::PipelineStageFlagBits2::eNone).setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                .setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands).setDstAccessMask(vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite);
+            _bufferAcquires.push_back(b);
+        }
+        for (auto b : batch.imageReleases) {
+            b.setSrcStageMask(vk::PipelineStageFlagBits2::eNone).setSrcAccessMask(vk::AccessFlagBits2::eNone)
+                .setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands).setDstAccessMask(vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite);
+            _imageAcquires.push_back(b);
+        }
+        _mipAcquires.insert(_mipAcquires.end(), batch.mips.begin(), batch.mips.end());
+    }
+
+    const Ticket ticket{ batch.value };
+    _inFlight.push_back(std::move(batch));
+    _batch.reset();
+    _nextValue++;
+    return ticket;
+}
+
+bool UploadEngine::isComplete(const Ticket ticket) const
+{
+    return semaphore.getCounterValue() >= ticket.value;
+}
+
+bool UploadEngine::wait(const Ticket ticket, const uint64_t timeout) const
+{
+    if (ticket.value == 0) return true;
+    return dev->waitSemaphores(vk::SemaphoreWaitInfo{ {}, *semaphore, ticket.value }, timeout) == vk::Result::eSuccess;
+}
+
+void UploadEngine::cmdAcquire(const vk::raii::CommandBuffer& cb)
+{
+    std::scoped_lock lock{ _mutex };
+    if (_bufferAcquires.empty() && _imageAcquires.empty()) return;
+    cb.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(_bufferAcquires).setImageMemoryBarriers(_imageAcquires));
+    for (const auto& [image, finalLayout] : _mipAcquires) image->cmdGenerateMips(cb, finalLayout);
+    _bufferAcquires.clear();
+    _imageAcquires.clear();
+    _mipAcquires.clear();
+}
+
+std::pair<const Buffer*, vk::DeviceSize> UploadEngine::_stage(const void* src, const vk::DeviceSize byteSize, const vk::DeviceSize alignment)
+{
+    constexpr vk::MemoryPropertyFlags hostMemory = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    if (byteSize > chunkSize) {
+        auto& buffer = _batch->oversized.emplace_back(dev, byteSize, vk::BufferUsageFlagBits::eTransferSrc, hostMemory, false, false, "staging");
+        buffer.write(src, byteSize);
+        buffer.flush();
+        return { &buffer, 0 };
+    }
+
+    vk::DeviceSize offset = _currentChunk ? utils::roundUpToMultipleOf(_currentChunk->head, alignment) : 0;
+    if (!_currentChunk || offset + byteSize > chunkSize) {
+        // reuse a chunk whose last batch completed, otherwise grow
+        const uint64_t completed = semaphore.getCounterValue();
+        const auto it = std::ranges::find_if(_chunks, [completed](const auto& c) { return c->lastValue <= completed; });
+        if (it != _chunks.end()) _currentChunk = it->get();
+        else _currentChunk = _chunks.emplace_back(std::make_unique<Chunk>(evk::Buffer{ dev, chunkSize, vk::BufferUsageFlagBits::eTransferSrc, hostMemory, false, false, "staging" }, 0, 0)).get();
+        offset = 0;
+    }
+    _currentChunk->buffer.write(src, byteSize, offset);
+    _currentChunk->buffer.flush();
+    _currentChunk->head = offset + byteSize;
+    _currentChunk->lastValue = _batch->value;
+    return { &_currentChunk->buffer, offset };
+}
+
+const vk::raii::CommandBuffer& UploadEngine::_recording()
+{
+    if (!_batch) {
+        vk::raii::CommandBuffer cb{ nullptr };
+        if (!_freeCommandBuffers.empty()) {
+            cb = std::move(_freeCommandBuffers.back());
+            _freeCommandBuffers.pop_back();
+            cb.reset();
+        }
+        else cb = commandPool.allocateCommandBuffer();
+        cb.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+        _batch.emplace(_nextValue, std::move(cb));
+    }
+    return _batch->cb;
+}
+
+void UploadEngine::_collect()
+{
+    const uint64_t completed = semaphore.getCounterValue();
+    while (!_inFlight.empty() && _inFlight.front().value <= completed) {
+        _freeCommandBuffers.push_back(std::move(_inFlight.front().cb));
+        _inFlight.pop_front();
+    }
+}
+
+TextureStreamer::TextureStreamer(
+    const evk::SharedPtr<Device>& device,
+    UploadEngine& uploads,
+    MutableDescriptorSet& descriptorSet,
+    const vk::Sampler sampler,
+    Loader loader,
+    const vk::DeviceSize budget,
+    const uint32_t tailSize,
+    const vk::DeviceSize uploadBytesPerFrame,
+    const uint32_t maxTextures
+) : Resource{ device }, uploads{ uploads }, descriptorSet{ descriptorSet }, sampler{ sampler }, loader{ std::move(loader) },
+    budget{ budget }, uploadBytesPerFrame{ uploadBytesPerFrame }, tailSize{ std::max(tailSize, 1u) },
+    descriptorIndices{ device, std::max(maxTextures, 1u) * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "streaming" } {}
+
+TextureStreamer::TextureId TextureStreamer::add(const vk::Extent2D extent, const vk::Format format, const uint32_t descriptorIndex)
+{
+    if ((textures.size() + 1u) * sizeof(uint32_t) > descriptorIndices.size) throw std::runtime_error{ "TextureStreamer holds maxTextures textures" };
+    const auto id = static_cast<TextureId>(textures.size());
+    const uint32_t mipCount = Image::fullMipCount({ extent.width, extent.height, 1 });
+    uint32_t tailMip = 0;
+    while (tailMip + 1u < mipCount && std::max(extent.width >> tailMip, extent.height >> tailMip) > tailSize) tailMip++;
+    textures.push_back({ extent, format, descriptorIndex, mipCount, tailMip, mipCount, tailMip });
+    _stream(id, tailMip);
+    return id;
+}
+
+void TextureStreamer::request(const TextureId texture, const uint32_t mipLevel, const float priority)
+{
+    Texture& t = textures.at(texture);
+    t.requestedMip = std::min({ t.requestedMip, mipLevel, t.tailMip });
+    t.priority = std::max(t.priority, priority);
+    t.lastUsed = _frames.next();
+}
+
+uint32_t TextureStreamer::mipForScreenSize(const vk::Extent2D extent, const float screenPixels)
+{
+    const uint32_t mipCount = Image::fullMipCount({ extent.width, extent.height, 1 });
+    const auto size = static_cast<float>(std::max(extent.width, extent.height));
+    if (screenPixels >= size) return 0;
+    if (screenPixels <= 1.0f) return mipCount - 1u;
+    return std::min(static_cast<uint32_t>(std::log2(size / screenPixels)), mipCount - 1u);
+}
+
+void TextureStreamer::update()
+{
+    _uploaded = 0;
+    // swap in what arrived once the descriptor it goes to is no longer sampled by frames in flight
+    std::erase_if(_pending, [this](Pending& p) {
+        if (p.ticket.value == 0 || !uploads.isComplete(p.ticket) || !_frames.retiredBefore(textures[p.texture].slotFree)) return false;
+        textures[p.texture].pending = false;
+        if (auto replaced = _swap(p.texture, std::move(p.image), p.mip)) _garbage.emplace_back(_frames.next(), std::move(replaced));
+        return true;
+    });
+    std::erase_if(_garbage, [this](const auto& garbage) { return _frames.retiredBefore(garbage.first); });
+
+    // the budget may have been lowered
+    while (_targetBytes() > budget && _evict()) {}
+
+    std::vector<TextureId> wanted;
+    for (TextureId id = 0; id < textures.size(); id++) {
+        if (!textures[id].pending && textures[id].requestedMip < textures[id].residentMip) wanted.push_back(id);
+    }
+    std::ranges::sort(wanted, std::greater{}, [this](const TextureId id) { return textures[id].priority; });
+
+    for (const TextureId id : wanted) {
+        if (_uploaded >= uploadBytesPerFrame) break;
+        const Texture& t = textures[id];
+        if (t.pending) continue; // picked by _evict meanwhile
+        // every mip is a quarter of the one above
+        const vk::DeviceSize current = t.image->memory.size;
+        const vk::DeviceSize needed = (current << (2u * (t.residentMip - t.requestedMip))) - current;
+        while (_targetBytes() + needed > budget && _evict()) {}
+        // evicted images are only freed once the frames sampling them retired, the upload waits for that memory
+        if (residentBytes() + needed > budget) break;
+        _uploaded += _stream(id, t.requestedMip);
+    }
+
+    if (std::ranges::any_of(_pending, [](const Pending& p) { return p.ticket.value == 0; })) {
+        const UploadEngine::Ticket ticket = uploads.flush();
+        for (Pending& p : _pending) if (p.ticket.value == 0) p.ticket = ticket;
+    }
+    for (Texture& t : textures) {
+        t.requestedMip = t.tailMip;
+        t.priority = 0.0f;
+    }
+}
+
+void TextureStreamer::cmdUpdate(const vk::raii::CommandBuffer& cb)
+{
+    if (_copies.empty() && _switched.empty()) return;
+    BarrierBatch barriers;
+    for (const auto& [src, dst] : _copies) {
+        barriers.transition(*src, vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eNone, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+        barriers.transition(*dst, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite);
+    }
+    // earlier frames still read the entries that are overwritten
+    if (!_switched.empty()) barriers.add(vk::MemoryBarrier2{ vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eNone, vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite });
+    barriers.flush(cb);
+
+    // mip i + 1 of the old image is mip i of the new one
+    for (const auto& [src, dst] : _copies) {
+        std::vector<vk::ImageCopy> regions;
+        for (uint32_t mip = 0; mip < dst->mipLevels && mip + 1u < src->mipLevels; mip++) {
+            regions.emplace_back(vk::ImageSubresourceLayers{ src->aspectMask, mip + 1u, 0, 1 }, vk::Offset3D{}, vk::ImageSubresourceLayers{ dst->aspectMask, mip, 0, 1 }, vk::Offset3D{}, dst->mipExtent(mip));
+        }
+        cb.copyImage(*src->image, vk::ImageLayout::eTransferSrcOptimal, *dst->image, vk::ImageLayout::eTransferDstOptimal, regions);
+        barriers.transition(*dst, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eShaderSampledRead);
+        // read by this frame's copy as well
+        _garbage.emplace_back(_frames.next(), src);
+    }
+    for (const TextureId id : _switched) {
+        const Texture& t = textures[id];
+        cb.updateBuffer<uint32_t>(*descriptorIndices.buffer, id * sizeof(uint32_t), t.descriptorIndex + t.slot);
+    }
+    if (!_switched.empty()) barriers.add(vk::MemoryBarrier2{ vk::PipelineStageFlagBits2::eAllTransfer, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eShaderStorageRead });
+    barriers.flush(cb);
+    _copies.clear();
+    _switched.clear();
+}
+
+vk::DeviceSize TextureStreamer::residentBytes() const
+{
+    vk::DeviceSize bytes = 0;
+    for (const Texture& t : textures) if (t.image) bytes += t.image->memory.size;
+    for (const Pending& p : _pending) bytes += p.image->memory.size;
+    for (const auto& [frame, image] : _garbage) bytes += image->memory.size;
+    for (const auto& [src, dst] : _copies) bytes += src->memory.size;
+    return bytes;
+}
+
+vk::DeviceSize TextureStreamer::_targetBytes() const
+{
+    // textures being replaced count with their new image
+    vk::DeviceSize bytes = 0;
+    for (const Texture& t : textures) if (!t.pending && t.image) bytes += t.image->memory.size;
+    for (const Pending& p : _pending) bytes += p.image->memory.size;
+    return bytes;
+}
+
+evk::SharedPtr<Image> TextureStreamer::_createImage(const Texture& texture, const uint32_t mip) const
+{
+    const vk::Extent3D extent{ std::max(texture.extent.width >> mip, 1u), std::max(texture.extent.height >> mip, 1u), 1u };
+    // transfer source for the copy that evicts its top mip
+    return evk::make_shared<Image>(dev, extent, texture.format, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, true, "streaming", 0);
+}
+
+vk::DeviceSize TextureStreamer::_stream(const TextureId texture, const uint32_t mip)
+{
+    Texture& t = textures[texture];
+    const std::vector<std::byte> texels = loader(texture, mip);
+    auto image = _createImage(t, mip);
+    uploads.upload(*image, texels.data(), vk::ImageLayout::eShaderReadOnlyOptimal, true);
+    _pending.push_back({ texture, mip, std::move(image), {} });
+    t.pending = true;
+    return texels.size();
+}
+
+bool TextureStreamer::_evict()
+{
+    Texture* victim = nullptr;
+    for (Texture& t : textures) {
+        if (t.pending || t.residentMip >= t.tailMip || !_frames.retiredBefore(t.slotFree)) continue;
+        // still sampled at its resident detail this frame
+        if (t.lastUsed >= _frames.next() && t.residentMip >= t.requestedMip) continue;
+        if (!victim || t.lastUsed < victim->lastUsed) victim = &t;
+    }
+    if (!victim) return false;
+
+    // the remaining mips are already on the device, they are copied instead of loaded again
+    const Image& src = *victim->image;
+    vk::DeviceSize bytes = 0;
+    for (uint32_t mip = 1; mip < src.mipLevels; mip++) bytes += src.mipByteSize(mip);
+    if (_uploaded + bytes > uploadBytesPerFrame) return false;
+    _uploaded += bytes;
+
+    const auto id = static_cast<TextureId>(victim - textures.data());
+    const uint32_t mip = victim->residentMip + 1u;
+    auto image = _createImage(*victim, mip);
+    auto dst = image;
+    _copies.emplace_back(_swap(id, std::move(image), mip), std::move(dst));
+    return true;
+}
+
+evk::SharedPtr<Image> TextureStreamer::_swap(const TextureId texture, evk::SharedPtr<Image> image, const uint32_t mip)
+{
+    Texture& t = textures[texture];
+    auto replaced = std::exchange(t.image, std::move(image));
+    t.residentMip = mip;
+    t.slot ^= 1u;
+    // frames recorded until now may still sample the descriptor that was just left
+    t.slotFree = _frames.next();
+    const vk::DescriptorImageInfo imageInfo{ sampler, *t.image->imageView, vk::ImageLayout::eShaderReadOnlyOptimal };
+    descriptorSet.write(t.descriptorIndex + t.slot, sampler ? vk::DescriptorType::eCombinedImageSampler : vk::DescriptorType::eSampledImage, imageInfo);
+    _switched.push_back(texture);
+    return replaced;
+}
+
+TextureStreamer::FrameId TextureStreamer::beginFrame()
+{
+    return _frames.begin();
+}
+
+void TextureStreamer::beginFrame(Swapchain::Frame& frame)
+{
+    _frames.begin(frame, [this](const FrameId id) { retire(id); });
+}
+
+void TextureStreamer::retire(const FrameId id)
+{
+    _frames.retire(id);
+}
+
+Defragmenter::FrameId Defragmenter::beginFrame()
+{
+    return _frames.begin();
+}
+
+void Defragmenter::beginFrame(Swapchain::Frame& frame)
+{
+    _frames.begin(frame, [this](const FrameId id) { retire(id); });
+}
+
+void Defragmenter::retire(const FrameId id)
+{
+    if (!_frames.retire(id)) return;
+    if (std::erase_if(_garbage, [this](const Garbage& g) { return _frames.retiredBefore(g.frame); }) > 0) dev->allocator->releaseEmptyBlocks();
+}
+
+void Defragmenter::_selectSource()
+{
+    MemoryAllocator& allocator = *dev->allocator;
+    std::scoped_lock lock{ allocator._mutex };
+    if (_source) {
+        // the block is erased by the allocator once its last allocation is freed
+        const bool alive = std::ranges::any_of(allocator._blocks, [this](const auto& blocks) {
+            return std::ranges::any_of(blocks, [this](const auto& b) { return b.get() == _source && b->id == _sourceId; });
+        });
+        if (alive) return;
+        _source = nullptr;
+    }
+
+    double bestRatio = 0.5; // fuller blocks are not worth the copies
+    for (const auto& blocks : allocator._blocks) {
+        if (blocks.size() < 2u) continue;
+        vk::DeviceSize freeBytes = 0;
+        for (const auto& b : blocks) if (!b->evacuating) freeBytes += b->size - b->tlsf.allocatedBytes;
+        for (const auto& b : blocks) {
+            if (b->tlsf.empty() || b->evacuating || std::ranges::find(_stuck, b->id) != _stuck.end()) continue;
+            const double ratio = static_cast<double>(b->tlsf.allocatedBytes) / static_cast<double>(b->size);
+            if (ratio >= bestRatio || freeBytes - (b->size - b->tlsf.allocatedBytes) < b->tlsf.allocatedBytes) continue;
+            bestRatio = ratio;
+            _source = b.get();
+            _sourceId = b->id;
+        }
+    }
+    if (_source) _source->evacuating = true;
+}
+
+Defragmenter::StepStats Defragmenter::cmdStep(const vk::raii::CommandBuffer& cb, const Budget& budget)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const auto overBudget = [&](const StepStats& stats) {
+        return stats.bytesMoved >= budget.bytes || std::chrono::steady_clock::now() - start >= budget.time;
+    };
+    std::erase_if(_buffers, [](const auto& b) { return b->refCount == 1; });
+    std::erase_if(_images, [](const auto& i) { return i->refCount == 1; });
+
+    StepStats stats;
+    _selectSource();
+    if (!_source) {
+        stats.done = true;
+        return stats;
+    }
+
+    const FrameId frame = _frames.next();
+    std::vector<vk::ImageMemoryBarrier2> preBarriers, postBarriers;
+    std::vector<std::function<void()>> copies;
+    std::vector<Buffer*> movedBuffers;
+    std::vector<Image*> movedImages;
+
+    for (auto& b : _buffers) {
+        if (overBudget(stats)) break;
+        Buffer& buffer = *b;
+        if (buffer.memory._block != _source || buffer.memory.mapped || buffer.externalHandle) continue;
+        const auto memoryRequirements = dev->getBufferMemoryRequirements2({ *buffer.buffer }).memoryRequirements;
+        Allocation memory = dev->allocator->tryAllocate(memoryRequirements, buffer.memory.memoryTypeIndex, false, buffer._tag);
+        if (!memory) continue;
+        vk::raii::Buffer moved{ *dev, { {}, buffer.size, buffer._usageFlags, vk::SharingMode::eExclusive } };
+        moved.bindMemory(*memory, memory.offset);
+        copies.emplace_back([&cb, src = *buffer.buffer, dst = *moved, size = buffer.size] { cb.copyBuffer(src, dst, vk::BufferCopy{ 0, 0, size }); });
+
+        std::swap(buffer.buffer, moved);
+        std::swap(buffer.memory, memory);
+        auto& garbage = _garbage.emplace_back(frame, std::move(memory));
+        garbage.buffer = std::move(moved);
+        if (buffer._usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) buffer.deviceAddress = dev->getBufferAddress({ *buffer.buffer });
+        movedBuffers.push_back(&buffer);
+        stats.bytesMoved += buffer.size;
+        stats.resourcesMoved++;
+    }
+
+    for (auto& i : _images) {
+        if (overBudget(stats)) break;
+        Image& image = *i;
+        if (image.memory._block != _source || image._tiling != vk::ImageTiling::eOptimal) continue;
+        vk::raii::Image moved{ *dev, image._createInfo };
+        const auto memoryRequirements = dev->getImageMemoryRequirements2({ *moved }).memoryRequirements;
+        Allocation memory = dev->allocator->tryAllocate(memoryRequirements, image.memory.memoryTypeIndex, true, image._tag);
+        if (!memory) continue;
+        moved.bindMemory(*memory, memory.offset);
+        vk::raii::ImageView movedView{ *dev, vk::ImageViewCreateInfo{ {}, *moved, image._imageViewType, image.format, {}, image.barrier.subresourceRange } };
+
+        // undefined content does not need to be copied
+        const vk::ImageLayout layout = image.barrier.oldLayout;
+        if (layout != vk::ImageLayout::eUndefined) {
+            const auto range = image.barrier.subresourceRange;
+            preBarriers.emplace_back(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead,
+                layout, vk::ImageLayout::eTransferSrcOptimal, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *image.image, range);
+            preBarriers.emplace_back(vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite,
+                vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *moved, range);
+            postBarriers.emplace_back(vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+                vk::ImageLayout::eTransferDstOptimal, layout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *moved, range);
+            std::vector<vk::ImageCopy> regions;
+            for (uint32_t mip = 0; mip < image.mipLevels; mip++) {
+                const vk::Extent3D mipExtent{ std::max(image.extent.width >> mip, 1u), std::max(image.extent.height >> mip, 1u), std::max(image.extent.depth >> mip, 1u) };
+                regions.emplace_back(vk::ImageSubresourceLayers{ image.aspectMask, mip, 0, image.arrayLayers }, vk::Offset3D{}, vk::ImageSubresourceLayers{ image.aspectMask, mip, 0, image.arrayLayers }, vk::Offset3D{}, mipExtent);
+            }
+            copies.emplace_back([&cb, src = *image.image, dst = *moved, regions = std::move(regions)] {
+                cb.copyImage(src, vk::ImageLayout::eTransferSrcOptimal, dst, vk::ImageLayout::eTransferDstOptimal, regions);
+            });
+            stats.bytesMoved += memoryRequirements.size;
+        }
+
+        std::swap(image.image, moved);
+        std::swap(image.imageView, movedView);
+        std::swap(image.memory, memory);
+        image.barrier.image = *image.image;
+        auto& garbage = _garbage.emplace_back(frame, std::move(memory));
+        garbage.image = std::move(moved);
+        garbage.imageView = std::move(movedView);
+        garbage.views = std::move(image._views);
+        image._views.clear();
+        movedImages.push_back(&image);
+        stats.resourcesMoved++;
+    }
+
+    if (!copies.empty()) {
+        constexpr vk::MemoryBarrier2 preBarrier{ vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead };
+        constexpr vk::MemoryBarrier2 postBarrier{ vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite };
+        cb.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(preBarrier).setImageMemoryBarriers(preBarriers));
+        for (const auto& copy : copies) copy();
+        cb.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(postBarrier).setImageMemoryBarriers(postBarriers));
+    }
+    for (Buffer* buffer : movedBuffers) if (onBufferRelocated) onBufferRelocated(*buffer);
+    for (Image* image : movedImages) if (onImageRelocated) onImageRelocated(*image);
+
+    // nothing movable is left, but the block still holds memory that is neither registered nor waiting for its frame to retire
+    if (stats.resourcesMoved == 0 && std::ranges::none_of(_garbage, [this](const Garbage& g) { return g.memory._block == _source; })) {
+        std::scoped_lock lock{ dev->allocator->_mutex };
+        _source->evacuating = false;
+        _stuck.push_back(_sourceId);
+        _source = nullptr;
+    }
+    return stats;
+}
@@ -10,8 +10,20 @@ module;
 #include <map>
 #include <stdexcept>
 #include <utility>
+#include <functional>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <bit>
+#include <atomic>
+#include <thread>
+#include <exception>
 export module evk:core;
 import :utils;
+import :memory;
 import vulkan;
 
 export namespace evk
@@ -54,6 +66,7 @@ export namespace evk
         using Queues = std::unordered_map<QueueFamily, QueueCount>;
 
         EVK_API Device() : vk::raii::Device{ nullptr }, physicalDevice{ nullptr }{}
+        // empty queues creates one queue of each family utils::findQueueFamilies picks (graphics, async compute, transfer)
         EVK_API Device(
             const evk::SharedPtr<Instance>& instance,
             const vk::raii::PhysicalDevice& physicalDevice,
@@ -67,6 +80,22 @@ export namespace evk
             vk::MemoryPropertyFlags propertyFlags
         ) const;
 
+        // scored pick with fallbacks instead of failing: required flags that can not be met (e.g. DeviceLocal | HostVisible
+        // without bar) become preferred, only HostVisible stays required. On small bar devices resources too large to be
+        // sub-allocated from the bar heap are moved to host memory so the 256MiB window is not used up by a few buffers
+        [[nodiscard]] EVK_API uint32_t selectMemoryType(
+            const vk::MemoryRequirements& requirements,
+            vk::MemoryPropertyFlags propertyFlags
+        ) const;
+        // same fallbacks, preferred and avoided flags only steer the pick (e.g. utils::readbackMemory)
+        [[nodiscard]] EVK_API uint32_t selectMemoryType(
+            const vk::MemoryRequirements& requirements,
+            const utils::MemoryTypeRequest& request
+        ) const;
+
+        // per heap budget and usage (VK_EXT_memory_budget when enabled) together with evk's own per heap/per tag accounting
+        [[nodiscard]] EVK_API MemoryStats memoryStats() const;
+
         [[nodiscard]] EVK_API bool imageFormatSupported(
             vk::Format format,
             vk::ImageType type,
@@ -87,7 +116,10 @@ export namespace evk
         EVK_API operator const vk::raii::PhysicalDevice& () const { return physicalDevice; }
 
         std::vector<std::vector<Queue>> _queues;
+        // role families among the created queues, see utils::findQueueFamilies. Families may be shared between roles
+        std::optional<QueueFamily> graphicsFamily, computeFamily, transferFamily;
         vk::raii::PhysicalDevice physicalDevice;
+        std::unique_ptr<MemoryAllocator> allocator;
 		// extra properties
         vk::PhysicalDeviceMemoryProperties memoryProperties;
         vk::PhysicalDeviceProperties properties;
@@ -95,8 +127,16 @@ export namespace evk
         vk::PhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties;
         vk::PhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties;
 		vk::PhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties;
+        vk::PhysicalDeviceExternalMemoryHostPropertiesEXT externalMemoryHostProperties;
         // has
         bool hasAccelerationStructureActive = false;
+        bool hasMemoryBudget = false;
+        bool hasExternalMemoryHost = false;
+        bool hasPresentWait = false; // presentId and presentWait features enabled
+        vk::PhysicalDeviceFeatures enabledFeatures; // core features of a vk::PhysicalDeviceFeatures2 in pNext
+        // device local memory the host can map, the whole vram with resizable bar (or on UMA devices), else a small window or nothing
+        vk::DeviceSize barSize = 0;
+        bool hasFullBar = false;
     };
 
     // Every resource has a device reference
@@ -113,9 +153,109 @@ export namespace evk
 
         [[nodiscard]] EVK_API vk::raii::CommandBuffer allocateCommandBuffer(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary) const;
 
+        // Recycling, not thread safe. acquire() takes a reset command buffer from the free list (allocating only when it is empty),
+        // release() hands it back together with the fence of the submit that used it. collect() resets the fences that signaled
+        // with one vkResetFences and returns their command buffers to the free list after an explicit reset (implicit resets on
+        // begin leak driver memory on some drivers). acquire() throws for pools without eResetCommandBuffer
+        [[nodiscard]] EVK_API vk::raii::CommandBuffer acquire(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+        // unsignaled fence owned by the pool, it returns to the free list once it was passed to release() and signaled
+        [[nodiscard]] EVK_API vk::Fence acquireFence();
+        // a null fence frees the command buffer right away (e.g. it was never submitted)
+        EVK_API void release(vk::raii::CommandBuffer&& commandBuffer, vk::Fence fence, vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary);
+        EVK_API void collect();
+        // records a one time submit command buffer with record, submits it and waits on its own fence only (other work on the
+        // queue is not waited for)
+        EVK_API void submitImmediate(const vk::raii::Queue& queue, const std::function<void(const vk::raii::CommandBuffer&)>& record);
+
+        struct InFlight
+        {
+            vk::Fence fence;
+            std::vector<std::pair<vk::CommandBufferLevel, vk::raii::CommandBuffer>> commandBuffers;
+        };
+
         vk::CommandPoolCreateFlags flags;
         Device::QueueFamily queueFamily;
         vk::raii::CommandPool commandPool;
+
+        // after commandPool, destroyed before it
+        std::vector<vk::raii::Fence> _fences;
+        std::vector<vk::Fence> _freeFences;
+        std::vector<InFlight> _inFlight;
+        std::vector<vk::raii::CommandBuffer> _free[2], _retired[2]; // [level], retired ones still need a reset
+    };
+
+    // Submission front-end of a queue. submit() only pushes a record into a bounded lock-free ring, a dedicated thread coalesces
+    // every record pushed since it last woke up into one vkQueueSubmit2 (in push order). Every record additionally signals the
+    // submitter's timeline semaphore, the ticket tracks it. The queue must not be used directly while a submitter owns it,
+    // present and waitIdle go through the submitter
+    struct QueueSubmitter : Resource
+    {
+        // the submit is done once the semaphore reaches value
+        struct Ticket { uint64_t value = 0; };
+        struct Submit
+        {
+            std::vector<vk::CommandBufferSubmitInfo> commandBuffers;
+            std::vector<vk::SemaphoreSubmitInfo> waits;
+            std::vector<vk::SemaphoreSubmitInfo> signals;
+            vk::Fence fence = nullptr; // ends the batch it is in
+        };
+
+        EVK_API QueueSubmitter() : Resource{ nullptr }, queue{ nullptr }, semaphore{ nullptr } {}
+        // capacity is rounded up to a power of two, submit() yields while the ring is full
+        EVK_API QueueSubmitter(
+            const evk::SharedPtr<Device>& device,
+            Device::QueueFamily queueFamily,
+            Device::QueueCount queueIndex = 0,
+            uint32_t capacity = 256
+        );
+        EVK_API QueueSubmitter(const QueueSubmitter&) = delete;
+        EVK_API QueueSubmitter& operator=(const QueueSubmitter&) = delete;
+        // submits everything pushed so far and joins the thread
+        EVK_API ~QueueSubmitter();
+
+        // thread safe, the command buffers and semaphores have to stay alive until the ticket completes
+        EVK_API Ticket submit(Submit submit);
+        // blocks until the record of ticket (and everything pushed before it) was handed to the driver, e.g. before a binary
+        // semaphore it signals is waited on by a present
+        EVK_API void flush(Ticket ticket) const;
+        // flushes everything pushed so far first
+        EVK_API vk::Result present(const vk::PresentInfoKHR& presentInfo);
+        EVK_API void waitIdle();
+
+        // both rethrow the submit failure for tickets that are never signaled because of it
+        [[nodiscard]] EVK_API bool isComplete(Ticket ticket) const;
+        // false on timeout
+        EVK_API bool wait(Ticket ticket, uint64_t timeout = UINT64_MAX) const;
+        // wait dependency for a later submit2 on another queue
+        [[nodiscard]] EVK_API vk::SemaphoreSubmitInfo waitInfo(const Ticket ticket, const vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands) const
+        {
+            return { *semaphore, ticket.value, stage };
+        }
+
+        struct Cell
+        {
+            std::atomic<uint64_t> sequence;
+            Submit submit;
+        };
+
+        void _run();
+        void _rethrow() const;
+        void _rethrow(Ticket ticket) const;
+
+        const Queue* queue;
+        vk::raii::Semaphore semaphore;
+
+        std::unique_ptr<Cell[]> _cells;
+        uint64_t _mask = 0;
+        std::atomic<uint64_t> _enqueuePos{ 0 }; // position n carries ticket value n + 1
+        uint64_t _dequeuePos = 0; // submission thread only
+        std::atomic<uint64_t> _pushed{ 0 }; // wakes the submission thread
+        std::atomic<uint64_t> _submitted{ 0 }; // last ticket value handed to the driver
+        std::atomic<bool> _stop{ false }, _failed{ false };
+        std::exception_ptr _error; // first vkQueueSubmit2 failure, rethrown by submit and flush
+        uint64_t _failedValue = 0; // first ticket of the failed vkQueueSubmit2, nothing from there on is submitted
+        std::mutex _queueMutex; // external synchronization of the queue between the thread, present and waitIdle
+        std::thread _thread;
     };
 
     // namespace Memory {
@@ -123,29 +263,88 @@ export namespace evk
     //     EVK_API constexpr vk::MemoryPropertyFlags devLocalHostVisible = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible;
     //     EVK_API constexpr vk::MemoryPropertyFlags devLocalHostVisibleCached = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCached;
     // }
-    struct Buffer : Resource, Shareable<Buffer>
-    {
 #ifdef _WIN32
-        using EXPORT_HANDLE = void*;
+    using ExternalHandle = void*;
 #elif __linux__
-        using EXPORT_HANDLE = int;
+    using ExternalHandle = int;
 #endif
+    // opaque handle exported by another process or device, e.g. received over a unix socket. On success the fd is owned by
+    // the importing object (win32 handles stay owned by the caller)
+    struct ImportHandle { ExternalHandle handle; };
+
+    struct Buffer : Resource, Shareable<Buffer>
+    {
+        using EXPORT_HANDLE = ExternalHandle;
         EVK_API Buffer();
         EVK_API Buffer(
             const evk::SharedPtr<Device>& device,
             vk::DeviceSize size,
             vk::BufferUsageFlags usageFlags,
             vk::MemoryPropertyFlags memoryPropertyFlags,
-            bool exportable = false
+            bool exportable = false,
+            bool dedicated = false, // own vkAllocateMemory instead of a sub-allocation
+            std::string_view tag = {} // accounting group in Device::memoryStats
+        );
+        EVK_API Buffer(
+            const evk::SharedPtr<Device>& device,
+            vk::DeviceSize size,
+            vk::BufferUsageFlags usageFlags,
+            const utils::MemoryTypeRequest& memoryRequest,
+            bool exportable = false,
+            bool dedicated = false,
+            std::string_view tag = {}
+        );
+        // wraps existing host memory without a copy (VK_EXT_external_memory_host), the device reads and writes it in place.
+        // hostPointer and size must be multiples of minImportedHostPointerAlignment and the memory has to outlive the buffer
+        EVK_API Buffer(
+            const evk::SharedPtr<Device>& device,
+            void* hostPointer,
+            vk::DeviceSize size,
+            vk::BufferUsageFlags usageFlags,
+            std::string_view tag = {}
+        );
+        // memory exported by a Buffer created with the same size and usage (exportable = true)
+        EVK_API Buffer(
+            const evk::SharedPtr<Device>& device,
+            ImportHandle importHandle,
+            vk::DeviceSize size,
+            vk::BufferUsageFlags usageFlags,
+            vk::MemoryPropertyFlags memoryPropertyFlags,
+            std::string_view tag = {}
         );
         EVK_API void resize(const vk::DeviceSize& s);
+
+        // host visible memory is mapped once on creation and stays mapped for the lifetime of the buffer
+        template<typename T = std::byte>
+        [[nodiscard]] std::span<T> data() const
+        {
+            if (!memory.mapped) throw std::runtime_error{ "Buffer is not host visible" };
+            return { static_cast<T*>(memory.mapped), static_cast<size_t>(size / sizeof(T)) };
+        }
+        // memcpy into the mapping and mark the range dirty
+        EVK_API void write(const void* src, vk::DeviceSize byteSize, vk::DeviceSize byteOffset = 0);
+        // host writes to non-coherent memory only become visible to the device after a flush, no-op for coherent memory
+        EVK_API void markDirty(vk::DeviceSize byteOffset = 0, vk::DeviceSize byteSize = vk::WholeSize);
+        EVK_API void flush();
+        // flush the dirty ranges of all buffers with a single vkFlushMappedMemoryRanges
+        EVK_API static void flush(const std::vector<Buffer*>& buffers);
+        // make device writes to non-coherent memory visible to the host
+        EVK_API void invalidate(vk::DeviceSize byteOffset = 0, vk::DeviceSize byteSize = vk::WholeSize) const;
+        [[nodiscard]] EVK_API bool isHostCoherent() const { return static_cast<bool>(memoryPropertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent); }
+
         vk::raii::Buffer buffer;
-        vk::raii::DeviceMemory memory;
+        evk::Allocation memory; // (memory, offset) inside a device memory block
         vk::DeviceAddress deviceAddress;
         vk::DeviceSize size;
+        vk::MemoryPropertyFlags memoryPropertyFlags; // of the memory type that was picked
 
         vk::BufferUsageFlags _usageFlags;
-        vk::MemoryPropertyFlags _memoryPropertyFlags;
+        utils::MemoryTypeRequest _memoryRequest;
+        bool _dedicated;
+        std::string _tag;
+        std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>> _dirtyRanges; // [begin, end) not flushed yet
+        void* _hostPointer = nullptr; // imported host memory
+        bool _imported = false; // memory owned by another process
 
         EXPORT_HANDLE externalHandle;
     };
@@ -201,34 +400,180 @@ export namespace evk
 
     struct Image : Resource, Shareable<Image>
     {
-        EVK_API Image() : Resource{ nullptr }, image{ nullptr }, imageView{ nullptr }, memory{ nullptr }, format{ vk::Format::eUndefined }, _tiling{} {}
+        EVK_API Image() : Resource{ nullptr }, image{ nullptr }, imageView{ nullptr }, format{ vk::Format::eUndefined }, _tiling{} {}
+        // allocateMemory = false only creates the vk::Image, memory is then provided through bindMemory (e.g. aliased by ImagePool)
         EVK_API Image(
             const evk::SharedPtr<Device>& device,
             vk::Extent3D extent,
             vk::Format format,
             vk::ImageTiling tiling,
             vk::ImageUsageFlags usageFlags,
-            vk::MemoryPropertyFlags memoryPropertyFlags
+            vk::MemoryPropertyFlags memoryPropertyFlags,
+            bool allocateMemory = true,
+            std::string_view tag = {}, // accounting group in Device::memoryStats
+            uint32_t mipLevels = 1, // 0 for the full chain down to 1x1
+            uint32_t arrayLayers = 1,
+            vk::ImageCreateFlags createFlags = {}, // eCubeCompatible with a multiple of 6 layers gives cube (array) views
+            bool exportable = false, // dedicated memory whose handle is in externalHandle
+            vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1 // multisampled images have a single mip
         );
+        EVK_API Image(
+            const evk::SharedPtr<Device>& device,
+            vk::Extent3D extent,
+            vk::Format format,
+            vk::ImageTiling tiling,
+            vk::ImageUsageFlags usageFlags,
+            const utils::MemoryTypeRequest& memoryRequest,
+            bool allocateMemory = true,
+            std::string_view tag = {},
+            uint32_t mipLevels = 1,
+            uint32_t arrayLayers = 1,
+            vk::ImageCreateFlags createFlags = {},
+            bool exportable = false,
+            vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1
+        );
+        // memory exported by an Image created with the same parameters (exportable = true)
+        EVK_API Image(
+            const evk::SharedPtr<Device>& device,
+            ImportHandle importHandle,
+            vk::Extent3D extent,
+            vk::Format format,
+            vk::ImageTiling tiling,
+            vk::ImageUsageFlags usageFlags,
+            vk::MemoryPropertyFlags memoryPropertyFlags,
+            std::string_view tag = {},
+            uint32_t mipLevels = 1,
+            uint32_t arrayLayers = 1,
+            vk::ImageCreateFlags createFlags = {}
+        );
+
+        static constexpr uint32_t allLayers = ~0u;
+        [[nodiscard]] EVK_API static uint32_t fullMipCount(const vk::Extent3D& extent) { return std::bit_width(std::max({ extent.width, extent.height, extent.depth, 1u })); }
+        [[nodiscard]] EVK_API vk::Extent3D mipExtent(const uint32_t mipLevel) const
+        {
+            return { std::max(extent.width >> mipLevel, 1u), std::max(extent.height >> mipLevel, 1u), std::max(extent.depth >> mipLevel, 1u) };
+        }
+        // one mip of every layer, block compressed formats are padded to whole blocks
+        [[nodiscard]] EVK_API vk::DeviceSize mipByteSize(const uint32_t mipLevel) const { return utils::imageByteSize(mipExtent(mipLevel), format) * arrayLayers; }
 
         EVK_API void resize(vk::Extent3D ex);
+        EVK_API void createImage(vk::Extent3D ex);
+        EVK_API void bindMemory(vk::DeviceMemory deviceMemory, vk::DeviceSize offset);
         EVK_API void transitionLayout(vk::ImageLayout newLayout);
+        // part of one mip, memory is addressed at ptr + memoryOffset with rows of memoryRowLength texels and layers of
+        // memoryImageHeight rows, 0 means tightly packed to the region's extent
+        struct Region
+        {
+            vk::Offset3D offset;
+            vk::Extent3D extent;
+            uint32_t mipLevel = 0;
+            uint32_t baseArrayLayer = 0, layerCount = 1;
+            vk::DeviceSize memoryOffset = 0;
+            uint32_t memoryRowLength = 0, memoryImageHeight = 0;
+        };
+
+        // mip 0 of every layer, layers tightly packed one after another
         EVK_API void copyMemoryToImage(const void* ptr) const;
         EVK_API void copyImageToMemory(void* ptr) const;
+        // all regions in a single host copy
+        EVK_API void copyMemoryToImage(const void* ptr, std::span<const Region> regions) const;
+        EVK_API void copyImageToMemory(void* ptr, std::span<const Region> regions) const;
+        // one mip of one layer, or of all layers (with the image's view type) for layer = allLayers, cached until the image is recreated
+        [[nodiscard]] EVK_API vk::ImageView view(uint32_t mipLevel, uint32_t layer = allLayers);
+        // fills mips 1.. by blitting each level from the previous one, mip 0 has to be in barrier.oldLayout. Afterwards the
+        // whole image is in finalLayout. Needs a graphics queue and a format with blit support
+        EVK_API void cmdGenerateMips(const vk::raii::CommandBuffer& cb, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal);
+        // dynamic rendering attachment that renders into this multisampled image and resolves into resolveTarget at the end of
+        // the pass. The samples are not stored, so a transient (lazily allocated) image never leaves tile memory. eNone picks
+        // eAverage for color and eSampleZero for depth/stencil
+        [[nodiscard]] EVK_API vk::RenderingAttachmentInfo resolveAttachment(const Image& resolveTarget, const vk::ClearValue& clearValue = {}, vk::ResolveModeFlagBits resolveMode = vk::ResolveModeFlagBits::eNone) const;
 
         vk::raii::Image image;
-        vk::raii::ImageView imageView;
-        vk::raii::DeviceMemory memory;
+        vk::raii::ImageView imageView; // all mips and layers
+        evk::Allocation memory; // empty when the memory is owned by someone else
         vk::ImageViewAddressPropertiesNVX imageViewAddressProperties;
 
         vk::Extent3D extent;
         vk::Format format;
         vk::ImageAspectFlags aspectMask;
-        evk::ImageMemoryBarrier2 barrier;
+        uint32_t mipLevels = 1, arrayLayers = 1;
+        vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+        evk::ImageMemoryBarrier2 barrier; // covers all mips and layers
 
+        std::unordered_map<uint64_t, vk::raii::ImageView> _views; // [mip << 32 | layer]
+        uint32_t _requestedMipLevels = 1;
+        vk::ImageCreateFlags _createFlags;
         vk::ImageTiling _tiling;
         vk::ImageUsageFlags _usageFlags;
-        vk::MemoryPropertyFlags _memoryPropertyFlags;
+        utils::MemoryTypeRequest _memoryRequest;
+        vk::ImageViewType _imageViewType;
+        vk::ImageCreateInfo _createInfo;
+        std::string _tag;
+        bool _exportable = false;
+        bool _imported = false;
+
+        ExternalHandle externalHandle{};
+    };
+
+    // Matching release/acquire barrier pairs moving exclusive resources from one queue family to another. cmdRelease is recorded
+    // on the source queue, cmdAcquire on the destination queue in a submit that waits on the releasing one. Within one family
+    // the barriers are plain ones and cmdRelease records all of them
+    struct OwnershipTransfer
+    {
+        EVK_API OwnershipTransfer(
+            Device::QueueFamily srcQueueFamily,
+            Device::QueueFamily dstQueueFamily,
+            vk::PipelineStageFlags2 srcStageMask,
+            vk::AccessFlags2 srcAccessMask,
+            vk::PipelineStageFlags2 dstStageMask,
+            vk::AccessFlags2 dstAccessMask
+        );
+
+        EVK_API OwnershipTransfer& add(const Buffer& buffer);
+        // the layout change happens once, between release and acquire. image.barrier.oldLayout becomes newLayout
+        EVK_API OwnershipTransfer& add(Image& image, std::optional<vk::ImageLayout> newLayout = {});
+        EVK_API void cmdRelease(const vk::raii::CommandBuffer& cb) const;
+        EVK_API void cmdAcquire(const vk::raii::CommandBuffer& cb) const;
+
+        Device::QueueFamily srcQueueFamily, dstQueueFamily;
+        vk::PipelineStageFlags2 srcStageMask, dstStageMask;
+        vk::AccessFlags2 srcAccessMask, dstAccessMask;
+        std::vector<vk::BufferMemoryBarrier2> bufferReleases, bufferAcquires;
+        std::vector<vk::ImageMemoryBarrier2> imageReleases, imageAcquires;
+    };
+
+    // Collects barriers and records them with one pipelineBarrier2 in flush(), called right before the next draw, dispatch or copy.
+    // An image barrier on a range with a pending one is merged into it when it repeats it or continues its transition (old
+    // layout of the first, new layout of the second, both scopes), so are barriers on the same buffer range. Memory barriers
+    // all merge into one
+    struct BarrierBatch
+    {
+        EVK_API BarrierBatch& add(const vk::ImageMemoryBarrier2& barrier);
+        EVK_API BarrierBatch& add(const vk::BufferMemoryBarrier2& barrier);
+        EVK_API BarrierBatch& add(const vk::MemoryBarrier2& barrier);
+        // whole buffer
+        EVK_API BarrierBatch& add(
+            const Buffer& buffer,
+            vk::PipelineStageFlags2 srcStageMask,
+            vk::AccessFlags2 srcAccessMask,
+            vk::PipelineStageFlags2 dstStageMask,
+            vk::AccessFlags2 dstAccessMask
+        );
+        // whole image from its tracked layout (barrier.oldLayout) to newLayout, the tracked layout is updated right away
+        EVK_API BarrierBatch& transition(
+            Image& image,
+            vk::ImageLayout newLayout,
+            vk::PipelineStageFlags2 srcStageMask,
+            vk::AccessFlags2 srcAccessMask,
+            vk::PipelineStageFlags2 dstStageMask,
+            vk::AccessFlags2 dstAccessMask
+        );
+        EVK_API void flush(const vk::raii::CommandBuffer& cb);
+        [[nodiscard]] EVK_API bool empty() const { return imageBarriers.empty() && bufferBarriers.empty() && !memoryBarrier; }
+
+        std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+        std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+        std::optional<vk::MemoryBarrier2> memoryBarrier;
     };
 
     struct MutableDescriptorSetLayout : Resource
@@ -435,33 +780,67 @@ export namespace evk
 
     struct Swapchain : Resource, Shareable<Swapchain>
     {
-        // Data for one frame/image in our swapchain
+        // Data for one frame of the ring, reused every framesInFlight frames
         struct Frame {
             EVK_API Frame(const vk::raii::Device& device, const vk::raii::CommandPool& commandPool) :
-                presentFinishFence{ device, vk::FenceCreateInfo{} }, imageAvailableSemaphore{ device, vk::SemaphoreCreateInfo{} }, renderFinishedSemaphore{ device, vk::SemaphoreCreateInfo{} },
+                presentFinishFence{ device, vk::FenceCreateInfo{} }, submitFinishFence{ device, vk::FenceCreateInfo{} },
+                imageAvailableSemaphore{ device, vk::SemaphoreCreateInfo{} }, renderFinishedSemaphore{ device, vk::SemaphoreCreateInfo{} },
                 commandBuffer{ std::move(vk::raii::CommandBuffers{ device, { *commandPool, vk::CommandBufferLevel::ePrimary, 1 } }[0]) }
             {}
-            vk::raii::Fence presentFinishFence;
+            vk::raii::Fence presentFinishFence, submitFinishFence;
             vk::raii::Semaphore imageAvailableSemaphore, renderFinishedSemaphore;
             vk::raii::CommandBuffer commandBuffer;
+            // called once the gpu is done with this frame (its fences signaled)
+            std::vector<std::function<void()>> onRetire;
+            bool submitted = false, presented = false; // submitFinishFence/presentFinishFence pending
         };
 
-        EVK_API Swapchain(const evk::SharedPtr<Device>& device, const vk::SwapchainCreateInfoKHR& createInfo, const uint32_t queueFamilyIndex) : Resource{ device }, currentImageIdx{ 0 }, previousImageIdx{ 0 },
-            swapchain{ nullptr }, commandPool{ *dev, { vk::CommandPoolCreateFlagBits::eTransient, queueFamilyIndex } }
+        // at most framesInFlight frames are in flight, acquiring one more blocks on the oldest
+        EVK_API Swapchain(const evk::SharedPtr<Device>& device, const vk::SwapchainCreateInfoKHR& createInfo, const uint32_t queueFamilyIndex, const uint32_t framesInFlight = 2) :
+            Resource{ device }, currentImageIdx{ 0 }, previousImageIdx{ 0 }, swapchain{ nullptr },
+            commandPool{ *dev, { vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamilyIndex } }
         {
+            if (framesInFlight == 0) throw std::invalid_argument{ "Swapchain needs at least one frame in flight" };
             swapchainCreateInfo = createInfo;
             currentImageIdx = swapchainCreateInfo.minImageCount - 1u; // just for init
+            frames.reserve(framesInFlight);
+            for (uint32_t i = 0; i < framesInFlight; ++i) frames.emplace_back(*dev, commandPool);
+            frameIndex = framesInFlight - 1u; // the first acquire starts at frame 0
             createSwapchain();
         }
 
         EVK_API ~Swapchain()
         {
-            while(frames.size()) {
-                for (auto it = frames.begin(); it != frames.end(); (it->presentFinishFence.getStatus() == vk::Result::eSuccess) ? it = frames.erase(it) : ++it) {}
+            for (auto& frame : frames) waitFrame(frame);
+        }
+
+        // blocks until the gpu is done with frame, then runs its onRetire callbacks
+        EVK_API void waitFrame(Frame& frame) {
+            std::vector<vk::Fence> fences;
+            if (frame.submitted) fences.push_back(*frame.submitFinishFence);
+            if (frame.presented) fences.push_back(*frame.presentFinishFence);
+            if (!fences.empty()) {
+                checkResult(dev->waitForFences(fences, true, UINT64_MAX), "Failed to wait for frame");
+                dev->resetFences(fences);
+            }
+            frame.submitted = frame.presented = false;
+            for (const auto& f : frame.onRetire) f();
+            frame.onRetire.clear();
+        }
+
+        // retires every submitted frame whose fences signaled, without blocking
+        EVK_API void retireFrames() {
+            for (auto& frame : frames) {
+                if (!frame.submitted && !frame.presented) continue; // retired or being recorded
+                if (frame.submitted && frame.submitFinishFence.getStatus() != vk::Result::eSuccess) continue;
+                if (frame.presented && frame.presentFinishFence.getStatus() != vk::Result::eSuccess) continue;
+                waitFrame(frame);
             }
         }
 
         EVK_API void createSwapchain() {
+            // the old swapchain (and the views of its images) is destroyed below, only the frames presenting to it are drained
+            for (auto& frame : frames) if (frame.presented) waitFrame(frame);
             const auto surfaceCapabilities = dev->physicalDevice.getSurfaceCapabilitiesKHR(swapchainCreateInfo.surface);
             swapchainCreateInfo.imageExtent = surfaceCapabilities.currentExtent;
             swapchainCreateInfo.oldSwapchain = *swapchain;
@@ -470,18 +849,24 @@ export namespace evk
             views.clear(); for (const auto& image : images) views.emplace_back(nullptr);
         }
 
+        // next frame of the ring with its command buffer reset
         EVK_API Frame& acquireNewFrame() {
-            for (auto it = frames.begin(); it != frames.end(); (it->presentFinishFence.getStatus() == vk::Result::eSuccess) ? it = frames.erase(it) : ++it) {}
-            frames.emplace_back(*dev, commandPool); // create a new frame
-            return frames.back();
+            frameIndex = (frameIndex + 1u) % static_cast<uint32_t>(frames.size());
+            auto& frame = frames[frameIndex];
+            waitFrame(frame);
+            frame.commandBuffer.reset();
+            return frame;
         }
 
         EVK_API void acquireNextImage() {
             auto& frame = acquireNewFrame();
-            try {
-                currentImageIdx = swapchain.acquireNextImage(UINT64_MAX, *frame.imageAvailableSemaphore).value;
+            while (true) {
+                try {
+                    currentImageIdx = swapchain.acquireNextImage(UINT64_MAX, *frame.imageAvailableSemaphore).value;
+                    break;
+                }
+                catch (const vk::OutOfDateKHRError&) { createSwapchain(); } // unix
             }
-            catch (const vk::OutOfDateKHRError&) { createSwapchain(); acquireNextImage(); return; } // unix
             /* create image view after image is acquired because of vk::SwapchainCreateFlagBitsKHR::eDeferredMemoryAllocationEXT */
             if (not *views[currentImageIdx]) {
                 views[currentImageIdx] = vk::raii::ImageView{ *dev, vk::ImageViewCreateInfo{ {}, images[currentImageIdx], vk::ImageViewType::e2D,
@@ -491,23 +876,83 @@ export namespace evk
         }
 
         EVK_API void submitImage(const vk::raii::Queue& presentQueue, const vk::PipelineStageFlags2 waitDstStageMask = vk::PipelineStageFlagBits2::eNone) {
-            auto& frame = frames.back();
+            auto& frame = frames[frameIndex];
             frame.commandBuffer.end();
 
             vk::SemaphoreSubmitInfo wait = { *frame.imageAvailableSemaphore, {}, waitDstStageMask };
             vk::CommandBufferSubmitInfo present = { *frame.commandBuffer };
             vk::SemaphoreSubmitInfo signal = { *frame.renderFinishedSemaphore, {}, vk::PipelineStageFlagBits2::eAllCommands };
-            presentQueue.submit2(vk::SubmitInfo2{ {}, wait, present, signal });
+            presentQueue.submit2(vk::SubmitInfo2{ {}, wait, present, signal }, *frame.submitFinishFence);
+            frame.submitted = true;
             vk::SwapchainPresentFenceInfoEXT presentFenceInfo{ *frame.presentFinishFence };
+            const uint64_t presentId = ++lastPresentId;
+            const vk::PresentIdKHR presentIdInfo{ 1, &presentId };
+            if (dev->hasPresentWait) presentFenceInfo.pNext = &presentIdInfo;
+            // an out of date present is still enqueued, its semaphore wait and fence signal happen as usual
+            frame.presented = true;
             try { auto _ = presentQueue.presentKHR({ *frame.renderFinishedSemaphore, *swapchain, currentImageIdx, {}, &presentFenceInfo }); }
-            catch (const vk::OutOfDateKHRError&) { presentQueue.waitIdle(); frames.clear(); createSwapchain(); } // win32
+            catch (const vk::OutOfDateKHRError&) { createSwapchain(); } // win32
+        }
+
+        // same as above with the frame submit going through the submitter that owns the present queue
+        EVK_API void submitImage(QueueSubmitter& submitter, const vk::PipelineStageFlags2 waitDstStageMask = vk::PipelineStageFlagBits2::eNone) {
+            auto& frame = frames[frameIndex];
+            frame.commandBuffer.end();
+
+            submitter.submit({
+                { vk::CommandBufferSubmitInfo{ *frame.commandBuffer } },
+                { vk::SemaphoreSubmitInfo{ *frame.imageAvailableSemaphore, {}, waitDstStageMask } },
+                { vk::SemaphoreSubmitInfo{ *frame.renderFinishedSemaphore, {}, vk::PipelineStageFlagBits2::eAllCommands } },
+                *frame.submitFinishFence
+            });
+            frame.submitted = true;
+            vk::SwapchainPresentFenceInfoEXT presentFenceInfo{ *frame.presentFinishFence };
+            const uint64_t presentId = ++lastPresentId;
+            const vk::PresentIdKHR presentIdInfo{ 1, &presentId };
+            if (dev->hasPresentWait) presentFenceInfo.pNext = &presentIdInfo;
+            frame.presented = true;
+            try { auto _ = submitter.present({ *frame.renderFinishedSemaphore, *swapchain, currentImageIdx, {}, &presentFenceInfo }); }
+            catch (const vk::OutOfDateKHRError&) { createSwapchain(); } // win32
         }
 
-        EVK_API Frame& getCurrentFrame() { return frames.back(); }
+        // recreates the swapchain with mode, false when the surface does not support it
+        EVK_API bool setPresentMode(const vk::PresentModeKHR mode) {
+            if (mode == swapchainCreateInfo.presentMode) return true;
+            const auto modes = dev->physicalDevice.getSurfacePresentModesKHR(swapchainCreateInfo.surface);
+            if (std::ranges::find(modes, mode) == modes.end()) return false;
+            swapchainCreateInfo.presentMode = mode;
+            createSwapchain();
+            return true;
+        }
+
+        // Device::hasPresentWait only. Blocks until the present with id (lastPresentId after that present) reached the display,
+        // false on timeout. Updates presentTiming
+        EVK_API bool waitPresent(const uint64_t id, const uint64_t timeout = UINT64_MAX) {
+            if (!dev->hasPresentWait) throw std::runtime_error{ "Present wait needs the presentId and presentWait features" };
+            if (id == 0 || id <= presentTiming.presentId) return true;
+            try { if (swapchain.waitForPresent(id, timeout) == vk::Result::eTimeout) return false; }
+            catch (const vk::OutOfDateKHRError&) { return true; } // recreated on the next acquire, nothing left to wait for
+            const auto now = std::chrono::steady_clock::now();
+            if (presentTiming.presentId) {
+                const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - presentTiming.presented);
+                presentTiming.interval = elapsed / static_cast<int64_t>(id - presentTiming.presentId);
+            }
+            presentTiming.presentId = id;
+            presentTiming.presented = now;
+            return true;
+        }
+        // latency pacing, called before acquireNextImage: blocks until at most framesQueued presents wait to be displayed.
+        // 0 or 1 for interactive use, higher values only throttle the cpu to the display rate
+        EVK_API bool waitPresented(const uint32_t framesQueued, const uint64_t timeout = UINT64_MAX) {
+            return lastPresentId <= framesQueued || waitPresent(lastPresentId - framesQueued, timeout);
+        }
+
+        EVK_API Frame& getCurrentFrame() { return frames[frameIndex]; }
         EVK_API vk::Image& getCurrentImage() { return images[currentImageIdx]; }
         EVK_API vk::raii::ImageView& getCurrentImageView() { return views[currentImageIdx]; }
         [[nodiscard]] EVK_API const vk::Extent2D& extent() const { return swapchainCreateInfo.imageExtent; }
         [[nodiscard]] EVK_API uint32_t imageCount() const { return swapchainCreateInfo.minImageCount; }
+        [[nodiscard]] EVK_API uint32_t framesInFlight() const { return static_cast<uint32_t>(frames.size()); }
 
         vk::SwapchainCreateInfoKHR swapchainCreateInfo;
         uint32_t currentImageIdx, previousImageIdx;
@@ -515,6 +960,650 @@ export namespace evk
         std::vector<vk::Image> images;
         std::vector<vk::raii::ImageView> views;
         vk::raii::CommandPool commandPool;
-        std::deque<Frame> frames;
+        std::vector<Frame> frames; // ring, frames[frameIndex] is the current one
+        uint32_t frameIndex = 0;
+        uint64_t lastPresentId = 0; // id of the latest present, chained as VkPresentIdKHR with Device::hasPresentWait
+        struct PresentTiming
+        {
+            uint64_t presentId = 0; // latest present waitPresent saw reach the display
+            std::chrono::steady_clock::time_point presented; // when that wait returned
+            std::chrono::nanoseconds interval{ 0 }; // present to present time, averaged over the presents between the last two waits
+        } presentTiming;
+    };
+
+    // Frames in flight of an object that keeps what a frame used alive until the gpu is done with it. Things used from now on
+    // are tagged with next() and may go once retiredBefore(tag). Frames may retire out of order, a frame only counts as
+    // retired once every frame begun before it did
+    struct FrameTracker
+    {
+        using FrameId = uint64_t;
+
+        EVK_API FrameId begin()
+        {
+            _frames.emplace_back(_nextFrameId, false);
+            return _nextFrameId++;
+        }
+        // retire(id) is called once the swapchain retired frame
+        EVK_API FrameId begin(Swapchain::Frame& frame, std::function<void(FrameId)> retire)
+        {
+            const FrameId id = begin();
+            frame.onRetire.emplace_back([retire = std::move(retire), id] { retire(id); });
+            return id;
+        }
+        // false when an older frame is still in flight, so nothing new counts as retired
+        EVK_API bool retire(const FrameId id)
+        {
+            for (auto& [frameId, retired] : _frames) if (frameId == id) retired = true;
+            const size_t inFlight = _frames.size();
+            while (!_frames.empty() && _frames.front().second) _frames.pop_front();
+            return _frames.size() != inFlight;
+        }
+
+        [[nodiscard]] EVK_API FrameId next() const { return _nextFrameId; }
+        // next() when every frame retired
+        [[nodiscard]] EVK_API FrameId oldest() const { return _frames.empty() ? _nextFrameId : _frames.front().first; }
+        [[nodiscard]] EVK_API bool retiredBefore(const FrameId tag) const { return oldest() >= tag; }
+
+        std::deque<std::pair<FrameId, bool>> _frames; // (id, retired) of frames in flight
+        FrameId _nextFrameId = 0;
+    };
+
+    // Multithreaded recording into secondary command buffers. Every recording thread gets its own CommandPool (created on its first
+    // begin), cmdExecute runs the secondaries on the primary sorted by their order key, no matter which thread finished first.
+    // Secondaries inside dynamic rendering inherit it from the rendering info, the primary then begins rendering with
+    // eContentsSecondaryCommandBuffers. A thread's buffers are reused once the frame they were recorded in is retired
+    struct ParallelRecorder : Resource
+    {
+        using FrameId = FrameTracker::FrameId;
+        using Job = std::function<void(uint32_t, const vk::raii::CommandBuffer&)>;
+
+        EVK_API ParallelRecorder() : Resource{ nullptr } {}
+        EVK_API ParallelRecorder(const evk::SharedPtr<Device>& device, Device::QueueFamily queueFamily);
+
+        [[nodiscard]] EVK_API FrameId beginFrame();
+        EVK_API void beginFrame(Swapchain::Frame& frame);
+        EVK_API void retire(FrameId id);
+
+        // thread safe, a begun secondary of the calling thread's pool that the thread has to end before cmdExecute
+        EVK_API const vk::raii::CommandBuffer& begin(uint32_t order, const vk::CommandBufferInheritanceRenderingInfo* rendering = nullptr);
+        // job(i, cb) for every i in [0, count) spread over pool, cb is begun with order i and ended after the job
+        EVK_API void record(utils::ThreadPool& pool, uint32_t count, const Job& job, const vk::CommandBufferInheritanceRenderingInfo* rendering = nullptr);
+        // executes every secondary begun since the last call
+        EVK_API void cmdExecute(const vk::raii::CommandBuffer& primary);
+
+        struct Slot
+        {
+            CommandPool pool;
+            std::deque<std::pair<FrameId, vk::raii::CommandBuffer>> used; // (frame tag, cb), released to pool once the frame retired
+        };
+
+        Device::QueueFamily queueFamily = 0;
+        std::unordered_map<std::thread::id, std::unique_ptr<Slot>> _slots;
+        std::vector<std::pair<uint32_t, vk::CommandBuffer>> _recorded; // (order, cb) since the last cmdExecute
+        FrameTracker _frames;
+        std::mutex _mutex; // _slots, _recorded and the frames, a slot itself is only touched by its thread
+    };
+
+    // Linear ring allocator handing out slices of one persistently mapped host visible buffer for per frame data,
+    // a frame's slices are given back when the frame retires (e.g. when its fence signaled)
+    struct TransientAllocator : Resource
+    {
+        struct Slice
+        {
+            void* data;
+            vk::Buffer buffer;
+            vk::DeviceSize offset, size;
+            vk::DeviceAddress deviceAddress;
+
+            // offset for eUniformBufferDynamic/eStorageBufferDynamic bindings that point to TransientAllocator::descriptorInfo
+            [[nodiscard]] EVK_API uint32_t dynamicOffset() const { return static_cast<uint32_t>(offset); }
+            [[nodiscard]] EVK_API vk::DescriptorBufferInfo descriptorInfo() const { return { buffer, offset, size }; }
+            template<typename T> [[nodiscard]] T* as() const { return static_cast<T*>(data); }
+        };
+        using FrameId = FrameTracker::FrameId;
+
+        EVK_API TransientAllocator() : Resource{ nullptr }, _mapped{ nullptr }, _alignment{ 0 } {}
+        EVK_API TransientAllocator(
+            const evk::SharedPtr<Device>& device,
+            vk::DeviceSize size,
+            vk::BufferUsageFlags usageFlags = vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress
+        );
+
+        // starts a new frame, everything allocated until the next beginFrame is released by retire(id)
+        [[nodiscard]] EVK_API FrameId beginFrame();
+        // starts a new frame that is released once the swapchain retires it
+        EVK_API void beginFrame(Swapchain::Frame& frame);
+        EVK_API void retire(FrameId id);
+
+        // alignment 0 uses the larger of the uniform/storage buffer offset alignments
+        [[nodiscard]] EVK_API Slice allocate(vk::DeviceSize size, vk::DeviceSize alignment = 0);
+        template<typename T>
+        [[nodiscard]] Slice push(const T& data, const vk::DeviceSize alignment = 0)
+        {
+            Slice slice = allocate(sizeof(T), alignment);
+            std::memcpy(slice.data, &data, sizeof(T));
+            return slice;
+        }
+
+        // binding info for dynamic descriptors, the slice is selected with Slice::dynamicOffset at bind time
+        [[nodiscard]] EVK_API vk::DescriptorBufferInfo descriptorInfo(vk::DeviceSize range) const { return { *buffer.buffer, 0, range }; }
+
+        evk::Buffer buffer;
+        std::byte* _mapped;
+        vk::DeviceSize _alignment;
+        // monotonic offsets, the physical offset is offset % buffer.size
+        vk::DeviceSize _head = 0, _tail = 0;
+        FrameTracker _frames;
+        std::deque<std::pair<FrameId, vk::DeviceSize>> _frameEnds; // (frame, _head after its last allocation)
+    };
+
+    // Recycles images by (extent, format, usage, tiling, memory properties) instead of reallocating them, and lets
+    // transient images of a frame whose passes never overlap share one block of memory
+    struct ImagePool : Resource
+    {
+        struct Desc
+        {
+            vk::Extent3D extent;
+            vk::Format format;
+            vk::ImageUsageFlags usageFlags;
+            vk::ImageTiling tiling = vk::ImageTiling::eOptimal;
+            vk::MemoryPropertyFlags memoryPropertyFlags = vk::MemoryPropertyFlagBits::eDeviceLocal;
+            uint32_t mipLevels = 1;
+            uint32_t arrayLayers = 1;
+            vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+            bool operator==(const Desc&) const = default;
+        };
+        // image used by the passes [firstPass, lastPass] of a frame
+        struct TransientDesc
+        {
+            Desc desc;
+            uint32_t firstPass, lastPass;
+            bool operator==(const TransientDesc&) const = default;
+        };
+        using FrameId = FrameTracker::FrameId;
+
+        EVK_API ImagePool() : Resource{ nullptr } {}
+        EVK_API explicit ImagePool(const evk::SharedPtr<Device>& device) : Resource{ device } {}
+
+        // images handed out after beginFrame are only reused once that frame is retired and every other reference is dropped
+        [[nodiscard]] EVK_API FrameId beginFrame();
+        EVK_API void beginFrame(Swapchain::Frame& frame);
+        EVK_API void retire(FrameId id);
+
+        [[nodiscard]] EVK_API evk::SharedPtr<Image> acquire(const Desc& desc);
+        // one image per desc, images whose pass ranges do not overlap may alias the same memory, so their content
+        // is undefined (barrier.oldLayout is eUndefined) on every acquire. Optimal tiling only
+        [[nodiscard]] EVK_API std::vector<evk::SharedPtr<Image>> acquireTransient(const std::vector<TransientDesc>& descs);
+        // destroys every image and alias block that is not in use
+        EVK_API void trim();
+
+        struct Entry { Desc desc; evk::SharedPtr<Image> image; FrameId lastFrame; };
+        struct AliasSet
+        {
+            std::vector<TransientDesc> descs;
+            evk::Allocation memory;
+            std::vector<evk::SharedPtr<Image>> images; // destroyed before memory
+            FrameId lastFrame;
+        };
+
+        [[nodiscard]] EVK_API bool _available(const evk::SharedPtr<Image>& image, FrameId lastFrame) const;
+
+        std::vector<Entry> _images;
+        std::vector<std::unique_ptr<AliasSet>> _aliasSets;
+        FrameTracker _frames;
+    };
+
+    // Timeline semaphore that can be shared with another process (exportable = true), or opened from such an export.
+    // Sharing needs VK_KHR_external_semaphore_fd (VK_KHR_external_semaphore_win32 on windows)
+    struct TimelineSemaphore : Resource, Shareable<TimelineSemaphore>
+    {
+        EVK_API TimelineSemaphore() : Resource{ nullptr }, semaphore{ nullptr } {}
+        EVK_API TimelineSemaphore(const evk::SharedPtr<Device>& device, uint64_t initialValue = 0, bool exportable = false);
+        EVK_API TimelineSemaphore(const evk::SharedPtr<Device>& device, ImportHandle importHandle);
+
+        // a new handle on every call, the caller owns it
+        [[nodiscard]] EVK_API ExternalHandle exportHandle() const;
+        [[nodiscard]] EVK_API uint64_t value() const { return semaphore.getCounterValue(); }
+        EVK_API void signal(uint64_t value) const;
+        EVK_API bool wait(uint64_t value, uint64_t timeout = UINT64_MAX) const;
+        [[nodiscard]] EVK_API vk::SemaphoreSubmitInfo submitInfo(const uint64_t value, const vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands) const
+        {
+            return { *semaphore, value, stage };
+        }
+
+        vk::raii::Semaphore semaphore;
+        bool _exportable = false;
+    };
+
+    // N images handed from a producer process to a consumer process without copies. The producer creates the ring and passes
+    // exportHandles() to the consumer (e.g. with SCM_RIGHTS), which opens it with the same slot count and image parameters.
+    // Frame n lives in slot n % N. Two exported timeline semaphores count the produced and the consumed frames, so the producer
+    // only overwrites a slot once the consumer is done with it. Images are exchanged in eGeneral layout and owned by
+    // vk::QueueFamilyExternal between the two sides, cmdAcquire/cmdRelease record the ownership transfer.
+    // Both devices need VK_KHR_external_memory_fd and VK_KHR_external_semaphore_fd (or the win32 variants)
+    struct SharedImageRing : Resource
+    {
+        struct Handles
+        {
+            std::vector<ExternalHandle> images;
+            ExternalHandle produced, consumed;
+        };
+        // the submit2 that writes (producer) or reads (consumer) the slot waits on wait and signals signal
+        struct Slot
+        {
+            uint32_t index;
+            uint64_t frame;
+            Image* image;
+            vk::SemaphoreSubmitInfo wait, signal;
+        };
+
+        EVK_API SharedImageRing() : Resource{ nullptr }, producer{ false } {}
+        // producer side
+        EVK_API SharedImageRing(
+            const evk::SharedPtr<Device>& device,
+            uint32_t slotCount,
+            vk::Extent3D extent,
+            vk::Format format,
+            vk::ImageUsageFlags usageFlags
+        );
+        // consumer side
+        EVK_API SharedImageRing(
+            const evk::SharedPtr<Device>& device,
+            const Handles& handles,
+            vk::Extent3D extent,
+            vk::Format format,
+            vk::ImageUsageFlags usageFlags
+        );
+
+        // fresh handles for the consumer, only on the producer side
+        [[nodiscard]] EVK_API Handles exportHandles() const;
+        // next frame to write (producer) or read (consumer), stage is where the submit starts to touch the image
+        [[nodiscard]] EVK_API Slot next(vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands);
+        // consumer only: skips frames that were produced meanwhile, so the next read gets the newest one. They count as consumed
+        EVK_API void skipToLatest();
+        EVK_API void cmdAcquire(const vk::raii::CommandBuffer& cb, const Slot& slot, Device::QueueFamily queueFamily, vk::ImageLayout layout) const;
+        EVK_API void cmdRelease(const vk::raii::CommandBuffer& cb, const Slot& slot, Device::QueueFamily queueFamily, vk::ImageLayout layout) const;
+
+        std::vector<evk::SharedPtr<Image>> images;
+        evk::SharedPtr<TimelineSemaphore> produced, consumed;
+        bool producer;
+        uint64_t _frame = 0;
+    };
+
+    // Batches buffer and image uploads into staging chunks and copies them on a (preferably transfer only) queue,
+    // completion is tracked with a timeline semaphore instead of waitIdle. Needs the timelineSemaphore and synchronization2 features
+    // and exclusive use of the queue. Thread safe
+    struct UploadEngine : Resource
+    {
+        // the upload is done once the semaphore reaches value
+        struct Ticket { uint64_t value = 0; };
+
+        EVK_API UploadEngine() : Resource{ nullptr }, semaphore{ nullptr } {}
+        // resources are used on dstQueueFamily afterwards, if it differs from queueFamily the ownership is released
+        // by the upload and must be acquired with cmdAcquire on the destination queue
+        EVK_API UploadEngine(
+            const evk::SharedPtr<Device>& device,
+            Device::QueueFamily queueFamily,
+            Device::QueueFamily dstQueueFamily,
+            Device::QueueCount queueIndex = 0,
+            vk::DeviceSize chunkSize = 64ull * 1024ull * 1024ull
+        );
+        EVK_API UploadEngine(const UploadEngine&) = delete;
+        EVK_API UploadEngine& operator=(const UploadEngine&) = delete;
+        EVK_API ~UploadEngine();
+
+        // src is copied into staging memory immediately, the device copy is recorded into the current batch
+        EVK_API void upload(const Buffer& dst, const void* src, vk::DeviceSize byteSize, vk::DeviceSize dstOffset = 0);
+        // tightly packed texels of mip 0 of every layer, the image ends up in finalLayout. The other mips are blitted from mip 0
+        // right after the copy, or by cmdAcquire when the upload queue has no graphics support. dst has to outlive cmdAcquire.
+        // Block compressed formats can not be blitted, src holds every mip one after another (rows padded to whole blocks)
+        EVK_API void upload(Image& dst, const void* src, vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal, bool generateMips = true);
+        // submits the current batch, the ticket covers every upload since the last flush
+        EVK_API Ticket flush();
+
+        // both rethrow the submit failure for tickets that are never signaled because of it
+        [[nodiscard]] EVK_API bool isComplete(Ticket ticket) const;
+        // false on timeout
+        EVK_API bool wait(Ticket ticket, uint64_t timeout = UINT64_MAX) const;
+        // wait dependency for a later submit2 on another queue
+        [[nodiscard]] EVK_API vk::SemaphoreSubmitInfo waitInfo(Ticket ticket, vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands) const
+        {
+            return { *semaphore, ticket.value, stage };
+        }
+        // records the queue family acquire barriers (and pending mip generation) of every flushed upload not acquired yet,
+        // the submit must wait for their tickets
+        EVK_API void cmdAcquire(const vk::raii::CommandBuffer& cb);
+
+        struct Chunk { evk::Buffer buffer; vk::DeviceSize head; uint64_t lastValue; };
+        struct Batch
+        {
+            uint64_t value;
+            vk::raii::CommandBuffer cb;
+            std::vector<evk::Buffer> oversized; // uploads larger than a chunk get their own staging buffer
+            // recorded after all copies of the batch
+            std::vector<vk::BufferMemoryBarrier2> bufferReleases;
+            std::vector<vk::ImageMemoryBarrier2> imageReleases;
+            std::vector<std::pair<Image*, vk::ImageLayout>> mips; // generated on the destination queue
+        };
+
+        // (buffer, offset) of staging memory for the current batch, callers hold _mutex
+        std::pair<const Buffer*, vk::DeviceSize> _stage(const void* src, vk::DeviceSize byteSize, vk::DeviceSize alignment);
+        const vk::raii::CommandBuffer& _recording();
+        void _collect();
+
+        CommandPool commandPool;
+        const Queue* queue;
+        vk::raii::Semaphore semaphore;
+        Device::QueueFamily queueFamily, dstQueueFamily;
+        vk::DeviceSize chunkSize;
+
+        std::vector<std::unique_ptr<Chunk>> _chunks;
+        Chunk* _currentChunk = nullptr;
+        std::optional<Batch> _batch; // being recorded
+        std::deque<Batch> _inFlight;
+        std::vector<vk::raii::CommandBuffer> _freeCommandBuffers;
+        std::vector<vk::BufferMemoryBarrier2> _bufferAcquires;
+        std::vector<vk::ImageMemoryBarrier2> _imageAcquires;
+        std::vector<std::pair<Image*, vk::ImageLayout>> _mipAcquires;
+        bool _graphicsQueue = false;
+        uint64_t _nextValue = 1;
+        mutable std::mutex _mutex;
+    };
+
+    // Keeps more textures than fit into memory partially resident under a budget. Every texture owns two consecutive descriptors
+    // of a bindless MutableDescriptorSet from its descriptorIndex on, shaders reach the one in use through descriptorIndices
+    // (one uint per TextureId, valid once the mip tail arrived). Its image only holds the mips from residentMip on. Streaming a
+    // mip in uploads a new image (the coarser mips are blitted from its top mip), dropping one copies the remaining mips into a
+    // new image on the device. A new image goes to the descriptor pending frames no longer sample, cmdUpdate then points
+    // descriptorIndices at it. The mip tail (mips no larger than tailSize) is loaded by add() and never evicted. The binding needs
+    // eUpdateAfterBind, eUpdateUnusedWhilePending and ePartiallyBound, the frame submit runs uploads.cmdAcquire and waits on
+    // its tickets as for any other upload
+    struct TextureStreamer : Resource
+    {
+        using FrameId = FrameTracker::FrameId;
+        using TextureId = uint32_t;
+        // tightly packed texels of one mip level of a texture, for block compressed formats that mip and every smaller one
+        using Loader = std::function<std::vector<std::byte>(TextureId texture, uint32_t mipLevel)>;
+
+        struct Texture
+        {
+            vk::Extent2D extent; // of mip 0
+            vk::Format format;
+            uint32_t descriptorIndex; // first of its two descriptors
+            uint32_t mipCount; // full chain
+            uint32_t tailMip; // first mip of the always resident tail
+            uint32_t residentMip; // first mip in image, mipCount while nothing is resident yet
+            uint32_t requestedMip; // finest mip asked for since the last update
+            float priority = 0.0f;
+            FrameId lastUsed = 0;
+            evk::SharedPtr<Image> image;
+            uint32_t slot = 1; // descriptorIndex + slot holds image, the first image goes to slot 0
+            FrameId slotFree = 0; // the other descriptor is no longer sampled once every frame before it retired
+            bool pending = false; // a new image is being uploaded
+        };
+
+        EVK_API TextureStreamer(
+            const evk::SharedPtr<Device>& device,
+            UploadEngine& uploads,
+            MutableDescriptorSet& descriptorSet,
+            vk::Sampler sampler, // combined image samplers are written when set, sampled images otherwise
+            Loader loader,
+            vk::DeviceSize budget,
+            uint32_t tailSize = 64,
+            vk::DeviceSize uploadBytesPerFrame = 16ull * 1024ull * 1024ull,
+            uint32_t maxTextures = 4096
+        );
+
+        // only the mip tail is loaded right away, the descriptor is written once it arrived
+        [[nodiscard]] EVK_API TextureId add(vk::Extent2D extent, vk::Format format, uint32_t descriptorIndex);
+        // feedback for the current frame: the finest mip the texture is sampled at and how important it is (e.g. screen coverage)
+        EVK_API void request(TextureId texture, uint32_t mipLevel, float priority);
+        // finest mip worth having for a texture drawn screenPixels wide
+        [[nodiscard]] EVK_API static uint32_t mipForScreenSize(vk::Extent2D extent, float screenPixels);
+        // swaps in completed uploads, streams requested mips by priority and evicts least recently used mips while over budget.
+        // Uploads and eviction copies together stay within uploadBytesPerFrame
+        EVK_API void update();
+        // records the eviction copies and the descriptorIndices changes of the last update into a begun frame, before it samples
+        // any texture
+        EVK_API void cmdUpdate(const vk::raii::CommandBuffer& cb);
+        // memory held right now, including uploads in flight and replaced images frames in flight may still sample
+        [[nodiscard]] EVK_API vk::DeviceSize residentBytes() const;
+
+        // replaced images are only destroyed once every frame begun before the swap is retired
+        [[nodiscard]] EVK_API FrameId beginFrame();
+        EVK_API void beginFrame(Swapchain::Frame& frame);
+        EVK_API void retire(FrameId id);
+
+        UploadEngine& uploads;
+        MutableDescriptorSet& descriptorSet;
+        vk::Sampler sampler;
+        Loader loader;
+        vk::DeviceSize budget, uploadBytesPerFrame;
+        uint32_t tailSize;
+        std::vector<Texture> textures;
+        evk::Buffer descriptorIndices; // [TextureId], storage buffer
+
+        struct Pending { TextureId texture; uint32_t mip; evk::SharedPtr<Image> image; UploadEngine::Ticket ticket; };
+        [[nodiscard]] evk::SharedPtr<Image> _createImage(const Texture& texture, uint32_t mip) const;
+        // new image for texture starting at mip, returns the uploaded bytes
+        vk::DeviceSize _stream(TextureId texture, uint32_t mip);
+        // drops one mip of the least recently used texture, false if nothing can be evicted this update
+        bool _evict();
+        // makes image the texture's current one through its free descriptor, returns the replaced image
+        evk::SharedPtr<Image> _swap(TextureId texture, evk::SharedPtr<Image> image, uint32_t mip);
+        // what stays resident once the uploads in flight landed and the replaced images are gone
+        [[nodiscard]] vk::DeviceSize _targetBytes() const;
+
+        std::vector<Pending> _pending;
+        std::vector<std::pair<FrameId, evk::SharedPtr<Image>>> _garbage; // (first frame not using it, image)
+        std::vector<std::pair<evk::SharedPtr<Image>, evk::SharedPtr<Image>>> _copies; // (src, dst) evictions for cmdUpdate
+        std::vector<TextureId> _switched; // descriptorIndices entries for cmdUpdate
+        vk::DeviceSize _uploaded = 0; // by the current update
+        FrameTracker _frames;
+    };
+
+    // Growable typed array in device memory. push_back/append only touch host memory, cmdSync records the growth (copying the
+    // old contents on the device) and the staged uploads. Uploads are staged through a host visible ring that is reused across
+    // frames and only grows when the uploads in flight fill it. Replaced buffers live until the frame they were used in is retired
+    template<typename T>
+    struct DeviceVector : Resource
+    {
+        using FrameId = FrameTracker::FrameId;
+
+        DeviceVector() : Resource{ nullptr } {}
+        DeviceVector(
+            const evk::SharedPtr<Device>& device,
+            const vk::BufferUsageFlags usageFlags,
+            const size_t capacity = 0,
+            const std::string_view tag = {}
+        ) : Resource{ device }, _usageFlags{ usageFlags | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress },
+            _tag{ tag }, _reserved{ capacity } {}
+
+        [[nodiscard]] size_t size() const { return _size; }
+        [[nodiscard]] bool empty() const { return _size == 0; }
+        // elements the device buffer can hold, grows on the next cmdSync
+        [[nodiscard]] size_t capacity() const { return _capacity; }
+        [[nodiscard]] vk::DeviceAddress deviceAddress() const { return buffer.deviceAddress; }
+        [[nodiscard]] vk::DescriptorBufferInfo descriptorInfo() const { return { *buffer.buffer, 0, std::max<vk::DeviceSize>(_size * sizeof(T), 1u) }; }
+
+        void push_back(const T& value) { append({ &value, 1u }); }
+        void append(const std::span<const T> values)
+        {
+            _pending.insert(_pending.end(), values.begin(), values.end());
+            _size += values.size();
+        }
+        void reserve(const size_t count) { _reserved = std::max(_reserved, count); }
+        // only elements that are not synced yet can be dropped from the host side, shrinking below the synced size just
+        // forgets the tail on the device
+        void resize(const size_t count, const T& value = {})
+        {
+            if (count > _size) {
+                _pending.resize(_pending.size() + (count - _size), value);
+                _size = count;
+                return;
+            }
+            const size_t synced = _size - _pending.size();
+            _pending.resize(count > synced ? count - synced : 0u);
+            _size = count;
+        }
+        void clear() { resize(0); }
+
+        // starts a new frame, buffers released by cmdSync until the next beginFrame are destroyed by retire(id)
+        [[nodiscard]] FrameId beginFrame() { return _frames.begin(); }
+        void beginFrame(Swapchain::Frame& frame) { _frames.begin(frame, [this](const FrameId id) { retire(id); }); }
+        void retire(const FrameId id)
+        {
+            if (!_frames.retire(id)) return;
+            std::erase_if(_garbage, [this](const auto& g) { return _frames.retiredBefore(g.first); });
+            while (!_stagingEnds.empty() && _frames.retiredBefore(_stagingEnds.front().first)) {
+                _stagingTail = _stagingEnds.front().second;
+                _stagingEnds.pop_front();
+            }
+        }
+
+        // records growth and pending uploads, afterwards the contents are visible to all commands later in the queue
+        void cmdSync(const vk::raii::CommandBuffer& cb)
+        {
+            const size_t required = std::max(_size, _reserved);
+            const size_t synced = _size - _pending.size();
+            bool copied = false;
+            if (required > _capacity) {
+                // geometric growth keeps push_back amortized O(1)
+                const size_t capacity = std::max({ required, _capacity + _capacity / 2u, size_t{ 16 } });
+                Buffer grown{ dev, capacity * sizeof(T), _usageFlags, vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, _tag };
+                if (synced > 0) {
+                    _barrier(cb, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+                    cb.copyBuffer(*buffer.buffer, *grown.buffer, vk::BufferCopy{ 0, 0, synced * sizeof(T) });
+                    copied = true;
+                }
+                if (*buffer.buffer) _garbage.emplace_back(_frames.next(), std::move(buffer));
+                buffer = std::move(grown);
+                _capacity = capacity;
+                for (const auto& callback : onAddressChanged) callback(buffer.deviceAddress);
+            }
+            if (!_pending.empty()) {
+                const vk::DeviceSize byteSize = _pending.size() * sizeof(T);
+                const vk::DeviceSize offset = _stage(byteSize);
+                _staging.write(_pending.data(), byteSize, offset);
+                _staging.flush();
+                _barrier(cb, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite);
+                cb.copyBuffer(*_staging.buffer, *buffer.buffer, vk::BufferCopy{ offset, synced * sizeof(T), byteSize });
+                _pending.clear();
+                copied = true;
+            }
+            if (copied) _barrier(cb, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite);
+        }
+
+        // called with the new address whenever cmdSync moves the data, e.g. to refresh push constants
+        std::vector<std::function<void(vk::DeviceAddress)>> onAddressChanged;
+        evk::Buffer buffer;
+
+        static void _barrier(const vk::raii::CommandBuffer& cb, const vk::PipelineStageFlags2 srcStage, const vk::AccessFlags2 srcAccess, const vk::PipelineStageFlags2 dstStage, const vk::AccessFlags2 dstAccess)
+        {
+            const vk::MemoryBarrier2 barrier{ srcStage, srcAccess, dstStage, dstAccess };
+            cb.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(barrier));
+        }
+        // physical offset of byteSize contiguous bytes in the staging ring, a full ring is replaced by one twice as large
+        vk::DeviceSize _stage(const vk::DeviceSize byteSize)
+        {
+            const vk::DeviceSize capacity = _staging.size;
+            const vk::DeviceSize physical = capacity ? _stagingHead % capacity : 0u;
+            vk::DeviceSize offset = physical + byteSize > capacity ? _stagingHead - physical + capacity : _stagingHead; // wrap around
+            if (offset + byteSize - _stagingTail > capacity) {
+                // the old ring stays alive until the copies reading it are retired
+                if (*_staging.buffer) _garbage.emplace_back(_frames.next(), std::move(_staging));
+                _staging = Buffer{ dev, std::max({ byteSize, capacity * 2u, vk::DeviceSize{ 64u * 1024u } }), vk::BufferUsageFlagBits::eTransferSrc,
+                    vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, false, false, "staging" };
+                _stagingEnds.clear();
+                _stagingHead = _stagingTail = offset = 0;
+            }
+            _stagingHead = offset + byteSize;
+            if (_stagingEnds.empty() || _stagingEnds.back().first != _frames.next()) _stagingEnds.emplace_back(_frames.next(), _stagingHead);
+            else _stagingEnds.back().second = _stagingHead;
+            return offset % _staging.size;
+        }
+        vk::BufferUsageFlags _usageFlags;
+        std::string _tag;
+        size_t _size = 0, _capacity = 0, _reserved = 0;
+        std::vector<T> _pending; // elements [size - pending.size(), size) not uploaded yet
+        std::deque<std::pair<FrameId, evk::Buffer>> _garbage; // (first frame not using it, buffer)
+        evk::Buffer _staging;
+        // monotonic offsets like TransientAllocator, the physical offset is offset % _staging.size
+        vk::DeviceSize _stagingHead = 0, _stagingTail = 0;
+        std::deque<std::pair<FrameId, vk::DeviceSize>> _stagingEnds; // (first frame not using it, _stagingHead after its uploads)
+        FrameTracker _frames;
+    };
+
+    // Incrementally empties the sparsest memory block by moving registered resources into the other blocks with device copies,
+    // the emptied blocks are given back to the driver. Only sub-allocated buffers and optimal tiling images that are not host
+    // visible are moved. cmdStep has to be recorded before the frame uses the resources, moved resources get new handles,
+    // views and device addresses which are reported through the relocation callbacks (e.g. to rewrite descriptors)
+    struct Defragmenter : Resource
+    {
+        struct Budget
+        {
+            std::chrono::microseconds time{ 500 }; // cpu time for creating and recording the moves
+            vk::DeviceSize bytes = 32ull * 1024ull * 1024ull; // device copy volume
+        };
+        struct StepStats
+        {
+            vk::DeviceSize bytesMoved = 0;
+            uint32_t resourcesMoved = 0;
+            bool done = false; // no block is worth emptying
+        };
+        using FrameId = FrameTracker::FrameId;
+
+        EVK_API Defragmenter() : Resource{ nullptr } {}
+        EVK_API explicit Defragmenter(const evk::SharedPtr<Device>& device) : Resource{ device } {}
+
+        // registered resources are dropped once the defragmenter holds the last reference. A move copies the resource into a new
+        // one with the same usage, so it needs eTransferSrc and eTransferDst
+        EVK_API void add(const evk::SharedPtr<Buffer>& buffer)
+        {
+            constexpr auto transfer = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+            if ((buffer->_usageFlags & transfer) != transfer) throw std::invalid_argument{ "Defragmented buffers need eTransferSrc and eTransferDst usage" };
+            _buffers.push_back(buffer);
+            _stuck.clear();
+        }
+        EVK_API void add(const evk::SharedPtr<Image>& image)
+        {
+            constexpr auto transfer = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+            if ((image->_createInfo.usage & transfer) != transfer) throw std::invalid_argument{ "Defragmented images need eTransferSrc and eTransferDst usage" };
+            _images.push_back(image);
+            _stuck.clear();
+        }
+
+        // the memory a resource was moved out of is freed once the frame of the move is retired
+        [[nodiscard]] EVK_API FrameId beginFrame();
+        EVK_API void beginFrame(Swapchain::Frame& frame);
+        EVK_API void retire(FrameId id);
+
+        EVK_API StepStats cmdStep(const vk::raii::CommandBuffer& cb, const Budget& budget = {});
+
+        std::function<void(Buffer&)> onBufferRelocated;
+        std::function<void(Image&)> onImageRelocated;
+
+        struct Garbage
+        {
+            FrameId frame; // first frame not using it
+            evk::Allocation memory; // destroyed last
+            vk::raii::Image image{ nullptr };
+            vk::raii::ImageView imageView{ nullptr };
+            std::unordered_map<uint64_t, vk::raii::ImageView> views;
+            vk::raii::Buffer buffer{ nullptr };
+        };
+
+        // picks the block with the lowest fill ratio whose allocations fit into the free space of its siblings
+        void _selectSource();
+
+        std::vector<evk::SharedPtr<Buffer>> _buffers;
+        std::vector<evk::SharedPtr<Image>> _images;
+        // blocks are remembered by id across steps, a freed block's address may be reused by a new one
+        MemoryBlock* _source = nullptr;
+        uint64_t _sourceId = 0;
+        std::vector<uint64_t> _stuck; // blocks holding allocations the defragmenter can not move
+        std::deque<Garbage> _garbage;
+        FrameTracker _frames;
     };
 }
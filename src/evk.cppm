@@ -1,7 +1,11 @@
 module;
 export module evk;
+export import :memory;
 export import :core;
 export import :rt;
+export import :sparse;
+export import :bc;
+export import :graph;
 export import :utils;
 
 export import vulkan;
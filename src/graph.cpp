@@ -0,0 +1,293 @@
+module;
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+module evk;
+import :graph;
+import :core;
+import :utils;
+using namespace evk;
+
+namespace
+{
+    using Source = std::pair<vk::PipelineStageFlags2, vk::AccessFlags2>;
+
+    // a write use with any other access bit (e.g. a blend reading the attachment) also reads
+    constexpr vk::AccessFlags2 writeAccess = vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eColorAttachmentWrite |
+        vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite |
+        vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
+
+    // source scope of the barrier an access needs after the tracked ones, empty when it needs none. Updates state
+    std::optional<Source> hazard(RenderGraph::AccessState& state, const vk::PipelineStageFlags2 stages, const vk::AccessFlags2 access, const bool write, const bool layoutChange)
+    {
+        std::optional<Source> src;
+        if (write || layoutChange) {
+            // write after write/read, the transition of a read only leaves the dependency on this use's stages behind
+            if (layoutChange || state.writeStages || state.readStages) src = Source{ state.writeStages | state.readStages, state.writeAccess };
+            state = write ? RenderGraph::AccessState{ stages, {}, access, {} } : RenderGraph::AccessState{ stages, stages, {}, access };
+            return src;
+        }
+        // read after write, reads already made visible to these stages and accesses need nothing
+        const bool covered = !(stages & ~state.readStages) && !(access & ~state.readAccess);
+        if (state.writeStages && !covered) src = Source{ state.writeStages, state.writeAccess };
+        state.readStages |= stages;
+        state.readAccess |= access;
+        return src;
+    }
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(const BufferRef buffer, const vk::PipelineStageFlags2 stages, const vk::AccessFlags2 access)
+{
+    auto& uses = graph->_passes[pass].buffers;
+    const auto it = std::ranges::find(uses, buffer.index, &BufferUse::buffer);
+    if (it == uses.end()) uses.push_back({ buffer.index, stages, access, false });
+    else { it->stages |= stages; it->access |= access; }
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(const BufferRef buffer, const vk::PipelineStageFlags2 stages, const vk::AccessFlags2 access)
+{
+    read(buffer, stages, access);
+    std::ranges::find(graph->_passes[pass].buffers, buffer.index, &BufferUse::buffer)->write = true;
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(const ImageRef image, const vk::PipelineStageFlags2 stages, const vk::AccessFlags2 access, const vk::ImageLayout layout, const std::optional<vk::ImageSubresourceRange> range)
+{
+    graph->_passes[pass].images.push_back({ image.index, stages, access, layout, range, false });
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(const ImageRef image, const vk::PipelineStageFlags2 stages, const vk::AccessFlags2 access, const vk::ImageLayout layout, const std::optional<vk::ImageSubresourceRange> range)
+{
+    graph->_passes[pass].images.push_back({ image.index, stages, access, layout, range, true });
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffects()
+{
+    graph->_passes[pass].sideEffects = true;
+    return *this;
+}
+
+RenderGraph::RenderGraph(const evk::SharedPtr<Device>& device, ImagePool& imagePool) : Resource{ device }, imagePool{ &imagePool } {}
+
+RenderGraph::BufferRef RenderGraph::importBuffer(const Buffer& buffer, const vk::PipelineStageFlags2 lastStages, const vk::AccessFlags2 lastAccess)
+{
+    _buffers.push_back({ &buffer, { lastStages, {}, lastAccess, {} } });
+    return { static_cast<uint32_t>(_buffers.size() - 1) };
+}
+
+RenderGraph::ImageRef RenderGraph::importImage(Image& image, const std::optional<vk::ImageLayout> finalLayout, const vk::PipelineStageFlags2 lastStages, const vk::AccessFlags2 lastAccess)
+{
+    GraphImage graphImage;
+    graphImage.image = &image;
+    graphImage.handle = *image.image;
+    graphImage.range = image.barrier.subresourceRange;
+    graphImage.finalLayout = finalLayout;
+    return _addImage(std::move(graphImage), image.barrier.oldLayout, lastStages, lastAccess);
+}
+
+RenderGraph::ImageRef RenderGraph::importImage(
+    const vk::Image image,
+    const vk::ImageSubresourceRange& range,
+    const vk::ImageLayout layout,
+    const std::optional<vk::ImageLayout> finalLayout,
+    const vk::PipelineStageFlags2 lastStages,
+    const vk::AccessFlags2 lastAccess)
+{
+    GraphImage graphImage;
+    graphImage.handle = image;
+    graphImage.range = range;
+    graphImage.finalLayout = finalLayout;
+    return _addImage(std::move(graphImage), layout, lastStages, lastAccess);
+}
+
+RenderGraph::ImageRef RenderGraph::createImage(const ImagePool::Desc& desc)
+{
+    GraphImage graphImage;
+    graphImage.transient = desc;
+    graphImage.range = { utils::formatToAspectMask(desc.format), 0, desc.mipLevels, 0, desc.arrayLayers };
+    return _addImage(std::move(graphImage), vk::ImageLayout::eUndefined, {}, {});
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const std::string_view name, Record record)
+{
+    if (_compiled) throw std::runtime_error{ "RenderGraph is already compiled" };
+    _passes.push_back({ std::string{ name }, std::move(record) });
+    return { this, static_cast<uint32_t>(_passes.size() - 1) };
+}
+
+void RenderGraph::compile()
+{
+    // walk back from the roots, transients count as needed once a kept pass reads them
+    std::vector<bool> needed(_images.size(), false);
+    for (auto it = _passes.rbegin(); it != _passes.rend(); ++it) {
+        auto& pass = *it;
+        bool keep = pass.sideEffects || std::ranges::any_of(pass.buffers, &BufferUse::write);
+        for (const auto& use : pass.images) keep = keep || (use.write && (!_images[use.image].transient || needed[use.image]));
+        pass.culled = !keep;
+        if (!keep) continue;
+        for (const auto& use : pass.images) if (!use.write || use.access & ~writeAccess) needed[use.image] = true;
+    }
+
+    // transient lifetimes in kept pass indices, images of overlapping lifetimes never alias
+    uint32_t kept = 0;
+    for (const auto& pass : _passes) {
+        if (pass.culled) continue;
+        for (const auto& use : pass.images) {
+            auto& image = _images[use.image];
+            image.firstPass = std::min(image.firstPass, kept);
+            image.lastPass = std::max(image.lastPass, kept);
+        }
+        ++kept;
+    }
+    std::vector<ImagePool::TransientDesc> descs;
+    std::vector<size_t> transients;
+    for (size_t i = 0; i < _images.size(); ++i) {
+        const auto& image = _images[i];
+        if (!image.transient || image.firstPass == ~0u) continue;
+        descs.push_back({ *image.transient, image.firstPass, image.lastPass });
+        transients.push_back(i);
+    }
+    if (!descs.empty()) {
+        const auto pooled = imagePool->acquireTransient(descs);
+        for (size_t i = 0; i < transients.size(); ++i) {
+            auto& image = _images[transients[i]];
+            image.pooled = pooled[i];
+            image.image = image.pooled.get();
+            image.handle = *image.image->image;
+        }
+    }
+    _compiled = true;
+}
+
+void RenderGraph::execute(const vk::raii::CommandBuffer& cb)
+{
+    if (!_compiled) compile();
+    AccessState aliased{}; // every access to transients whose lifetime ended, their memory may be reused by later ones
+    std::vector<bool> ended(_images.size(), false);
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    uint32_t kept = 0;
+    for (const auto& pass : _passes) {
+        if (pass.culled) continue;
+        for (size_t i = 0; i < _images.size(); ++i) {
+            const auto& image = _images[i];
+            if (!image.transient || ended[i] || image.firstPass == ~0u || image.lastPass >= kept) continue;
+            ended[i] = true;
+            for (const auto& [layout, state] : image.states) {
+                aliased.writeStages |= state.writeStages | state.readStages;
+                aliased.writeAccess |= state.writeAccess;
+            }
+        }
+
+        bufferBarriers.clear();
+        imageBarriers.clear();
+        for (const auto& use : pass.buffers) {
+            auto& buffer = _buffers[use.buffer];
+            if (const auto src = hazard(buffer.state, use.stages, use.access, use.write, false)) {
+                bufferBarriers.emplace_back(src->first, src->second, use.stages, use.access, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *buffer.buffer->buffer, 0, vk::WholeSize);
+            }
+        }
+        for (const auto& use : pass.images) _useImage(_images[use.image], use, aliased, imageBarriers);
+        if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+            cb.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(bufferBarriers).setImageMemoryBarriers(imageBarriers));
+        }
+        if (pass.record) pass.record(cb);
+        ++kept;
+    }
+
+    // imported images end in one layout, the next user waits through its own semaphore or barrier
+    imageBarriers.clear();
+    for (auto& image : _images) {
+        if (image.transient) continue;
+        const vk::ImageLayout finalLayout = image.finalLayout.value_or(image.states.front().first);
+        _useImage(image, { 0, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, finalLayout, {}, false }, aliased, imageBarriers);
+        if (image.image) image.image->barrier.oldLayout = finalLayout;
+    }
+    if (!imageBarriers.empty()) cb.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(imageBarriers));
+}
+
+void RenderGraph::clear()
+{
+    _passes.clear();
+    _buffers.clear();
+    _images.clear();
+    _compiled = false;
+}
+
+Image& RenderGraph::image(const ImageRef ref) const
+{
+    const auto& image = _images.at(ref.index);
+    if (!image.image) throw std::runtime_error{ image.transient ? "Transient image is not used by any kept pass" : "Image is not an evk::Image" };
+    return *image.image;
+}
+
+RenderGraph::ImageRef RenderGraph::_addImage(GraphImage image, const vk::ImageLayout layout, const vk::PipelineStageFlags2 lastStages, const vk::AccessFlags2 lastAccess)
+{
+    if (_compiled) throw std::runtime_error{ "RenderGraph is already compiled" };
+    image.states.assign(static_cast<size_t>(image.range.levelCount) * image.range.layerCount, { layout, { lastStages, {}, lastAccess, {} } });
+    _images.push_back(std::move(image));
+    return { static_cast<uint32_t>(_images.size() - 1) };
+}
+
+vk::ImageSubresourceRange RenderGraph::_resolve(const GraphImage& image, const std::optional<vk::ImageSubresourceRange>& range) const
+{
+    if (!range) return image.range;
+    vk::ImageSubresourceRange resolved = *range;
+    if (resolved.levelCount == vk::RemainingMipLevels) resolved.levelCount = image.range.baseMipLevel + image.range.levelCount - resolved.baseMipLevel;
+    if (resolved.layerCount == vk::RemainingArrayLayers) resolved.layerCount = image.range.baseArrayLayer + image.range.layerCount - resolved.baseArrayLayer;
+    if (resolved.baseMipLevel < image.range.baseMipLevel || resolved.baseMipLevel + resolved.levelCount > image.range.baseMipLevel + image.range.levelCount ||
+        resolved.baseArrayLayer < image.range.baseArrayLayer || resolved.baseArrayLayer + resolved.layerCount > image.range.baseArrayLayer + image.range.layerCount) {
+        throw std::out_of_range{ "Subresource range exceeds the image" };
+    }
+    return resolved;
+}
+
+void RenderGraph::_useImage(GraphImage& image, const ImageUse& use, const AccessState& aliased, std::vector<vk::ImageMemoryBarrier2>& barriers) const
+{
+    // consecutive layers of a mip with the same source share a barrier, so do consecutive mips with the same layer runs
+    struct Run
+    {
+        vk::PipelineStageFlags2 stages;
+        vk::AccessFlags2 access;
+        vk::ImageLayout oldLayout;
+        uint32_t baseLayer, layerCount;
+        bool operator==(const Run&) const = default;
+    };
+    const auto range = _resolve(image, use.range);
+    std::vector<Run> runs, previousRuns;
+    size_t previousFirst = 0;
+    for (uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + range.levelCount; ++mip) {
+        runs.clear();
+        for (uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + range.layerCount; ++layer) {
+            auto& [layout, state] = image.states[static_cast<size_t>(layer - image.range.baseArrayLayer) * image.range.levelCount + (mip - image.range.baseMipLevel)];
+            if (image.transient && layout == vk::ImageLayout::eUndefined) state = aliased; // first use
+            const vk::ImageLayout oldLayout = layout;
+            const auto src = hazard(state, use.stages, use.access, use.write, oldLayout != use.layout);
+            layout = use.layout;
+            if (!src) continue;
+            const Run run{ src->first, src->second, oldLayout, layer, 1 };
+            if (!runs.empty() && runs.back().stages == run.stages && runs.back().access == run.access && runs.back().oldLayout == run.oldLayout &&
+                runs.back().baseLayer + runs.back().layerCount == layer) ++runs.back().layerCount;
+            else runs.push_back(run);
+        }
+        if (!runs.empty() && runs == previousRuns) {
+            for (size_t i = 0; i < runs.size(); ++i) ++barriers[previousFirst + i].subresourceRange.levelCount;
+            continue;
+        }
+        previousRuns = runs;
+        previousFirst = barriers.size();
+        for (const auto& run : runs) {
+            barriers.emplace_back(run.stages, run.access, use.stages, use.access, run.oldLayout, use.layout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored,
+                image.handle, vk::ImageSubresourceRange{ range.aspectMask, mip, 1, run.baseLayer, run.layerCount });
+        }
+    }
+}
@@ -0,0 +1,128 @@
+module;
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+export module evk:graph;
+import :utils;
+import :memory;
+import :core;
+import vulkan;
+
+export namespace evk
+{
+    // Frame graph. Passes declare how they access buffers and images, compile() culls the passes no result depends on and
+    // acquires the transient images from an ImagePool (transients whose passes do not overlap share memory). execute() records
+    // the kept passes in declaration order, each preceded by one pipelineBarrier2 holding exactly the barriers its accesses need.
+    // Image layouts and accesses are tracked per mip and layer. A graph is built, executed and dropped (or cleared) every frame,
+    // the pool's frames have to be begun/retired by the caller as usual
+    struct RenderGraph : Resource
+    {
+        struct BufferRef { uint32_t index = ~0u; };
+        struct ImageRef { uint32_t index = ~0u; };
+        using Record = std::function<void(const vk::raii::CommandBuffer&)>;
+
+        // accesses since the last write, a layout transition counts as a write
+        struct AccessState
+        {
+            vk::PipelineStageFlags2 writeStages, readStages;
+            vk::AccessFlags2 writeAccess, readAccess;
+        };
+        struct BufferUse { uint32_t buffer; vk::PipelineStageFlags2 stages; vk::AccessFlags2 access; bool write; };
+        struct ImageUse
+        {
+            uint32_t image;
+            vk::PipelineStageFlags2 stages;
+            vk::AccessFlags2 access;
+            vk::ImageLayout layout;
+            std::optional<vk::ImageSubresourceRange> range; // every mip and layer when empty
+            bool write;
+        };
+        struct Pass
+        {
+            std::string name;
+            Record record;
+            std::vector<BufferUse> buffers;
+            std::vector<ImageUse> images;
+            bool sideEffects = false;
+            bool culled = false;
+        };
+
+        // declares the accesses of one pass, uses of the same buffer within a pass are merged
+        struct PassBuilder
+        {
+            EVK_API PassBuilder& read(BufferRef buffer, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access);
+            EVK_API PassBuilder& write(BufferRef buffer, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access);
+            EVK_API PassBuilder& read(ImageRef image, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access, vk::ImageLayout layout, std::optional<vk::ImageSubresourceRange> range = {});
+            EVK_API PassBuilder& write(ImageRef image, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access, vk::ImageLayout layout, std::optional<vk::ImageSubresourceRange> range = {});
+            // never culled, e.g. readbacks or anything else with effects outside the graph
+            EVK_API PassBuilder& sideEffects();
+
+            RenderGraph* graph;
+            uint32_t pass;
+        };
+
+        struct GraphBuffer
+        {
+            const Buffer* buffer;
+            AccessState state;
+        };
+        struct GraphImage
+        {
+            Image* image = nullptr; // null for images not owned by evk
+            vk::Image handle;
+            vk::ImageSubresourceRange range; // the whole image
+            std::optional<ImagePool::Desc> transient;
+            evk::SharedPtr<Image> pooled;
+            std::optional<vk::ImageLayout> finalLayout;
+            std::vector<std::pair<vk::ImageLayout, AccessState>> states; // [layer * levelCount + mip]
+            uint32_t firstPass = ~0u, lastPass = 0; // transients, among the kept passes
+        };
+
+        EVK_API RenderGraph() : Resource{ nullptr } {}
+        EVK_API RenderGraph(const evk::SharedPtr<Device>& device, ImagePool& imagePool);
+
+        // lastStages/lastAccess are earlier writes the first use has to wait for, none when a semaphore or fence already orders them
+        EVK_API BufferRef importBuffer(const Buffer& buffer, vk::PipelineStageFlags2 lastStages = {}, vk::AccessFlags2 lastAccess = {});
+        // starts in image.barrier.oldLayout, which is updated by execute. Ends in finalLayout if given, else in the layout of its
+        // first subresource (so the single tracked layout stays true)
+        EVK_API ImageRef importImage(Image& image, std::optional<vk::ImageLayout> finalLayout = {}, vk::PipelineStageFlags2 lastStages = {}, vk::AccessFlags2 lastAccess = {});
+        // images not owned by evk, e.g. swapchain images. lastStages is the stage the acquire semaphore wait blocks on
+        EVK_API ImageRef importImage(
+            vk::Image image,
+            const vk::ImageSubresourceRange& range,
+            vk::ImageLayout layout,
+            std::optional<vk::ImageLayout> finalLayout = {},
+            vk::PipelineStageFlags2 lastStages = {},
+            vk::AccessFlags2 lastAccess = {}
+        );
+        // content is undefined on first use, desc.usageFlags must cover every use
+        EVK_API ImageRef createImage(const ImagePool::Desc& desc);
+        EVK_API PassBuilder addPass(std::string_view name, Record record);
+
+        // roots are passes with side effects and passes writing imported resources, a pass is kept if a kept pass reads what it writes
+        EVK_API void compile();
+        // compiles first if needed
+        EVK_API void execute(const vk::raii::CommandBuffer& cb);
+        // drops passes and resources, transients go back to the pool
+        EVK_API void clear();
+
+        // physical resources, transients only after compile
+        [[nodiscard]] EVK_API vk::Buffer buffer(BufferRef ref) const { return *_buffers.at(ref.index).buffer->buffer; }
+        [[nodiscard]] EVK_API vk::Image handle(ImageRef ref) const { return _images.at(ref.index).handle; }
+        [[nodiscard]] EVK_API Image& image(ImageRef ref) const;
+        [[nodiscard]] EVK_API bool isCulled(const uint32_t pass) const { return _passes.at(pass).culled; }
+
+        ImageRef _addImage(GraphImage image, vk::ImageLayout layout, vk::PipelineStageFlags2 lastStages, vk::AccessFlags2 lastAccess);
+        [[nodiscard]] vk::ImageSubresourceRange _resolve(const GraphImage& image, const std::optional<vk::ImageSubresourceRange>& range) const;
+        void _useImage(GraphImage& image, const ImageUse& use, const AccessState& aliased, std::vector<vk::ImageMemoryBarrier2>& barriers) const;
+
+        ImagePool* imagePool = nullptr;
+        std::vector<Pass> _passes;
+        std::vector<GraphBuffer> _buffers;
+        std::vector<GraphImage> _images;
+        bool _compiled = false;
+    };
+}
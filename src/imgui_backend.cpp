@@ -94,9 +94,7 @@ ImGuiBackend::ImGuiBackend(
     } }, sampler{ nullptr }
 {
 	vertexBuffers.resize(imageCount);
-	vertexBuffersPtr.resize(imageCount);
 	indexBuffers.resize(imageCount);
-	indexBuffersPtr.resize(imageCount);
 	auto tmp = std::deque<std::unique_ptr<evk::Buffer>>();
 	vertexBuffersToBeDeleted.resize(imageCount);
 	indexBuffersToBeDeleted.resize(imageCount);
@@ -148,7 +146,7 @@ void ImGuiBackend::render(const vk::raii::CommandBuffer& cb, const uint32_t imag
 					{ static_cast<uint32_t>(tex->Width), static_cast<uint32_t>(tex->Height) },
 					vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eLinear,
 					vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eHostTransfer,
-					vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal };
+					vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal, true, "imgui" };
 				backend_tex->image.transitionLayout(vk::ImageLayout::eGeneral);
 				backend_tex->image.copyMemoryToImage(tex->GetPixels());
 				backend_tex->descriptorSet = evk::DescriptorSet{ dev, descriptorSetLayout };
@@ -162,7 +160,14 @@ void ImGuiBackend::render(const vk::raii::CommandBuffer& cb, const uint32_t imag
 			}
 			else if (tex->Status == ImTextureStatus_WantUpdates) {
 				auto* backend_tex = static_cast<BackendTexture*>(tex->BackendUserData);
-				backend_tex->image.copyMemoryToImage(tex->GetPixels());
+				// only the dirty rectangles, addressed inside the full size pixel buffer
+				std::vector<evk::Image::Region> regions;
+				regions.reserve(tex->Updates.Size);
+				for (const ImTextureRect& r : tex->Updates) {
+					regions.push_back({ .offset = { r.x, r.y, 0 }, .extent = { r.w, r.h, 1 },
+						.memoryOffset = (static_cast<vk::DeviceSize>(r.y) * tex->Width + r.x) * tex->BytesPerPixel, .memoryRowLength = static_cast<uint32_t>(tex->Width) });
+				}
+				backend_tex->image.copyMemoryToImage(tex->GetPixels(), regions);
 				tex->SetStatus(ImTextureStatus_OK);
 			}
 			else if (tex->Status == ImTextureStatus_WantDestroy) {
@@ -185,18 +190,16 @@ void ImGuiBackend::render(const vk::raii::CommandBuffer& cb, const uint32_t imag
 		const size_t index_size = draw_data->TotalIdxCount * sizeof(ImDrawIdx);
 		if (!vertexBuffers[imageIdx] || vertexBuffers[imageIdx]->size < vertex_size) {
 			vertexBuffersToBeDeleted[imageIdx].emplace_back(std::move(vertexBuffers[imageIdx]));
-			vertexBuffers[imageIdx] = evk::Buffer::shared(dev, vertex_size, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal);
-			vertexBuffersPtr[imageIdx] = vertexBuffers[imageIdx]->memory.mapMemory(0, vk::WholeSize);
+			vertexBuffers[imageIdx] = evk::Buffer::shared(dev, vertex_size, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "imgui");
 		}
 		if (!indexBuffers[imageIdx] || indexBuffers[imageIdx]->size < index_size) {
 			indexBuffersToBeDeleted[imageIdx].emplace_back(std::move(indexBuffers[imageIdx]));
-			indexBuffers[imageIdx] = evk::Buffer::shared(dev, index_size, vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal);
-			indexBuffersPtr[imageIdx] = indexBuffers[imageIdx]->memory.mapMemory(0, vk::WholeSize);
+			indexBuffers[imageIdx] = evk::Buffer::shared(dev, index_size, vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "imgui");
 		}
 
 		// Upload vertex/index data into a single contiguous GPU buffer
-		auto* vtx_dst = static_cast<ImDrawVert*>(vertexBuffersPtr[imageIdx]);
-		auto* idx_dst = static_cast<ImDrawIdx*>(indexBuffersPtr[imageIdx]);
+		auto* vtx_dst = vertexBuffers[imageIdx]->data<ImDrawVert>().data();
+		auto* idx_dst = indexBuffers[imageIdx]->data<ImDrawIdx>().data();
 		for (int n = 0; n < draw_data->CmdListsCount; n++)
 		{
 			const ImDrawList* cmd_list = draw_data->CmdLists[n];
@@ -205,11 +208,9 @@ void ImGuiBackend::render(const vk::raii::CommandBuffer& cb, const uint32_t imag
 			vtx_dst += cmd_list->VtxBuffer.Size;
 			idx_dst += cmd_list->IdxBuffer.Size;
 		}
-		/*const vk::MappedMemoryRange memoryRanges[2] = {
-			{ vertexBuffers[imageIdx].memory, 0, vk::WholeSize},
-			{indexBuffers[imageIdx].memory, 0, vk::WholeSize}
-		};
-		dev->flushMappedMemoryRanges(memoryRanges);*/
+		vertexBuffers[imageIdx]->markDirty(0, vertex_size);
+		indexBuffers[imageIdx]->markDirty(0, index_size);
+		evk::Buffer::flush({ vertexBuffers[imageIdx].get(), indexBuffers[imageIdx].get() });
 
 		cb.setPrimitiveTopologyEXT(vk::PrimitiveTopology::eTriangleList);
 		cb.setPolygonModeEXT(vk::PolygonMode::eFill);
@@ -32,9 +32,7 @@ export namespace evk
         evk::DescriptorSetLayout descriptorSetLayout;
 		evk::ShaderObject shader;
 		std::vector<evk::SharedPtr<evk::Buffer>> vertexBuffers;
-		std::vector<void*> vertexBuffersPtr;
 		std::vector<evk::SharedPtr<evk::Buffer>> indexBuffers;
-		std::vector<void*> indexBuffersPtr;
 		std::vector<std::deque<evk::SharedPtr<evk::Buffer>>> vertexBuffersToBeDeleted;
 		std::vector<std::deque<evk::SharedPtr<evk::Buffer>>> indexBuffersToBeDeleted;
 
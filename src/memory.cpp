@@ -0,0 +1,411 @@
+module;
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+module evk;
+import :memory;
+import :utils;
+using namespace evk;
+
+namespace
+{
+    // first/second level index of the size class containing size
+    void mapping(const vk::DeviceSize size, uint32_t& fl, uint32_t& sl)
+    {
+        if (size < Tlsf::slCount) {
+            fl = 0;
+            sl = static_cast<uint32_t>(size);
+            return;
+        }
+        const uint32_t log2 = static_cast<uint32_t>(std::bit_width(size)) - 1u;
+        fl = log2 - Tlsf::slLog2 + 1u;
+        sl = static_cast<uint32_t>(size >> (log2 - Tlsf::slLog2)) ^ Tlsf::slCount;
+    }
+
+    // size class whose every block is at least size large
+    void mappingSearch(vk::DeviceSize size, uint32_t& fl, uint32_t& sl)
+    {
+        if (size >= Tlsf::slCount) {
+            const uint32_t log2 = static_cast<uint32_t>(std::bit_width(size)) - 1u;
+            size += (vk::DeviceSize{ 1 } << (log2 - Tlsf::slLog2)) - 1u;
+        }
+        mapping(size, fl, sl);
+    }
+
+    constexpr vk::DeviceSize MiB = 1024ull * 1024ull;
+    constexpr vk::DeviceSize GiB = 1024ull * MiB;
+}
+
+Tlsf::Tlsf(const vk::DeviceSize size) : size{ size }
+{
+    for (auto& fl : _freeLists) fl.fill(nil);
+    _slBitmap.fill(0);
+    insertFree(newNode({ 0, size, nil, nil, nil, nil, true }));
+}
+
+uint32_t Tlsf::newNode(const Node& node)
+{
+    if (_unusedNodes.empty()) {
+        _nodes.push_back(node);
+        return static_cast<uint32_t>(_nodes.size() - 1u);
+    }
+    const uint32_t idx = _unusedNodes.back();
+    _unusedNodes.pop_back();
+    _nodes[idx] = node;
+    return idx;
+}
+
+void Tlsf::insertFree(const uint32_t node)
+{
+    uint32_t fl, sl;
+    mapping(_nodes[node].size, fl, sl);
+    Node& n = _nodes[node];
+    n.free = true;
+    n.prevFree = nil;
+    n.nextFree = _freeLists[fl][sl];
+    if (n.nextFree != nil) _nodes[n.nextFree].prevFree = node;
+    _freeLists[fl][sl] = node;
+    _slBitmap[fl] |= 1u << sl;
+    _flBitmap |= uint64_t{ 1 } << fl;
+}
+
+void Tlsf::removeFree(const uint32_t node)
+{
+    uint32_t fl, sl;
+    mapping(_nodes[node].size, fl, sl);
+    Node& n = _nodes[node];
+    if (n.prevFree != nil) _nodes[n.prevFree].nextFree = n.nextFree;
+    else _freeLists[fl][sl] = n.nextFree;
+    if (n.nextFree != nil) _nodes[n.nextFree].prevFree = n.prevFree;
+    if (_freeLists[fl][sl] == nil) {
+        _slBitmap[fl] &= ~(1u << sl);
+        if (!_slBitmap[fl]) _flBitmap &= ~(uint64_t{ 1 } << fl);
+    }
+    n.free = false;
+}
+
+uint32_t Tlsf::findFree(const vk::DeviceSize s) const
+{
+    uint32_t fl, sl;
+    mappingSearch(s, fl, sl);
+    if (fl >= flCount) return nil;
+    uint32_t slMap = _slBitmap[fl] & (~0u << sl);
+    if (!slMap) {
+        const uint64_t flMap = fl + 1u < flCount ? _flBitmap & (~uint64_t{ 0 } << (fl + 1u)) : 0;
+        if (!flMap) return nil;
+        fl = static_cast<uint32_t>(std::countr_zero(flMap));
+        slMap = _slBitmap[fl];
+    }
+    sl = static_cast<uint32_t>(std::countr_zero(slMap));
+    return _freeLists[fl][sl];
+}
+
+uint32_t Tlsf::allocate(const vk::DeviceSize s, const vk::DeviceSize alignment, vk::DeviceSize& offset)
+{
+    // searching for size + alignment - 1 guarantees that any block of the found class fits after aligning its start
+    const uint32_t node = findFree(s + alignment - 1u);
+    if (node == nil) return nil;
+    removeFree(node);
+
+    const vk::DeviceSize alignedOffset = utils::roundUpToMultipleOf(_nodes[node].offset, alignment);
+    const vk::DeviceSize padding = alignedOffset - _nodes[node].offset;
+    if (padding) { // give the unaligned front back to the free lists
+        const uint32_t front = newNode({ _nodes[node].offset, padding, _nodes[node].prevPhys, node, nil, nil, true });
+        if (_nodes[front].prevPhys != nil) _nodes[_nodes[front].prevPhys].nextPhys = front;
+        _nodes[node].prevPhys = front;
+        _nodes[node].offset += padding;
+        _nodes[node].size -= padding;
+        insertFree(front);
+    }
+    if (_nodes[node].size > s) { // and the unused tail
+        const uint32_t back = newNode({ _nodes[node].offset + s, _nodes[node].size - s, node, _nodes[node].nextPhys, nil, nil, true });
+        if (_nodes[back].nextPhys != nil) _nodes[_nodes[back].nextPhys].prevPhys = back;
+        _nodes[node].nextPhys = back;
+        _nodes[node].size = s;
+        insertFree(back);
+    }
+
+    allocatedBytes += s;
+    allocationCount++;
+    offset = alignedOffset;
+    return node;
+}
+
+void Tlsf::free(uint32_t node)
+{
+    allocatedBytes -= _nodes[node].size;
+    allocationCount--;
+
+    // merge with free neighbours
+    const uint32_t prev = _nodes[node].prevPhys;
+    if (prev != nil && _nodes[prev].free) {
+        removeFree(prev);
+        _nodes[prev].size += _nodes[node].size;
+        _nodes[prev].nextPhys = _nodes[node].nextPhys;
+        if (_nodes[prev].nextPhys != nil) _nodes[_nodes[prev].nextPhys].prevPhys = prev;
+        _unusedNodes.push_back(node);
+        node = prev;
+    }
+    const uint32_t next = _nodes[node].nextPhys;
+    if (next != nil && _nodes[next].free) {
+        removeFree(next);
+        _nodes[node].size += _nodes[next].size;
+        _nodes[node].nextPhys = _nodes[next].nextPhys;
+        if (_nodes[node].nextPhys != nil) _nodes[_nodes[node].nextPhys].prevPhys = node;
+        _unusedNodes.push_back(next);
+    }
+    insertFree(node);
+}
+
+MemoryBlock::MemoryBlock(
+    const vk::raii::Device& device,
+    const vk::MemoryAllocateInfo& allocateInfo,
+    const bool dedicated,
+    const bool optimalTiling
+) : memory{ device, allocateInfo }, size{ allocateInfo.allocationSize }, memoryTypeIndex{ allocateInfo.memoryTypeIndex }, dedicated{ dedicated }, optimalTiling{ optimalTiling }
+{
+    if (!dedicated) tlsf = Tlsf{ size };
+}
+
+Allocation::Allocation(Allocation&& other) noexcept :
+    deviceMemory{ other.deviceMemory }, offset{ other.offset }, size{ other.size }, memoryTypeIndex{ other.memoryTypeIndex }, mapped{ std::exchange(other.mapped, nullptr) },
+    _allocator{ std::exchange(other._allocator, nullptr) }, _block{ std::exchange(other._block, nullptr) }, _node{ std::exchange(other._node, Tlsf::nil) }, _tag{ other._tag } {}
+
+Allocation& Allocation::operator=(Allocation&& other) noexcept
+{
+    if (this == &other) return *this;
+    if (_allocator) _allocator->free(*this);
+    deviceMemory = other.deviceMemory;
+    offset = other.offset;
+    size = other.size;
+    memoryTypeIndex = other.memoryTypeIndex;
+    mapped = std::exchange(other.mapped, nullptr);
+    _allocator = std::exchange(other._allocator, nullptr);
+    _block = std::exchange(other._block, nullptr);
+    _node = std::exchange(other._node, Tlsf::nil);
+    _tag = other._tag;
+    return *this;
+}
+
+Allocation::~Allocation()
+{
+    if (_allocator) _allocator->free(*this);
+}
+
+void* Allocation::map()
+{
+    if (!_block) throw std::runtime_error{ "Allocation is empty" };
+    if (!mapped) mapped = static_cast<uint8_t*>(_allocator->map(*_block)) + offset;
+    return mapped;
+}
+
+void Allocation::unmap()
+{
+    if (!_block || !mapped) return;
+    _allocator->unmap(*_block);
+    mapped = nullptr;
+}
+
+MemoryAllocator::MemoryAllocator(
+    const vk::raii::Device& device,
+    const vk::PhysicalDeviceMemoryProperties& memoryProperties,
+    const vk::DeviceSize nonCoherentAtomSize
+) : _device{ device }, _memoryProperties{ memoryProperties }, _nonCoherentAtomSize{ nonCoherentAtomSize }, _blocks(memoryProperties.memoryTypeCount * 2u),
+    _heapStats(memoryProperties.memoryHeapCount)
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) _heapStats[i].size = memoryProperties.memoryHeaps[i].size;
+    _tagStats.push_back({ {}, std::vector<MemoryUsage>(memoryProperties.memoryHeapCount), {} });
+}
+
+vk::DeviceSize MemoryAllocator::blockSize(const uint32_t memoryTypeIndex) const
+{
+    // small heaps (e.g. 256MiB bar) are split in 8 blocks so a single resource never takes the whole heap
+    const vk::DeviceSize heapSize = _memoryProperties.memoryHeaps[_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    return heapSize <= GiB ? utils::roundUpToMultipleOf(heapSize / 8u, vk::DeviceSize{ 32 }) : 256ull * MiB;
+}
+
+Allocation MemoryAllocator::allocate(const vk::MemoryRequirements& requirements, const uint32_t memoryTypeIndex, const bool optimalTiling, const std::string_view tag)
+{
+    if (requirements.size > blockSize(memoryTypeIndex) / 2u) return allocateDedicated(requirements, memoryTypeIndex, nullptr, tag);
+    return subAllocate(requirements, memoryTypeIndex, optimalTiling, tag, true);
+}
+
+Allocation MemoryAllocator::tryAllocate(const vk::MemoryRequirements& requirements, const uint32_t memoryTypeIndex, const bool optimalTiling, const std::string_view tag)
+{
+    if (requirements.size > blockSize(memoryTypeIndex) / 2u) return {};
+    return subAllocate(requirements, memoryTypeIndex, optimalTiling, tag, false);
+}
+
+Allocation MemoryAllocator::subAllocate(const vk::MemoryRequirements& requirements, const uint32_t memoryTypeIndex, const bool optimalTiling, const std::string_view tag, const bool mayGrow)
+{
+    const vk::DeviceSize bSize = blockSize(memoryTypeIndex);
+
+    // flush/invalidate work on whole atoms, so neighbours in non-coherent memory must not share one
+    const auto flags = _memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    vk::MemoryRequirements req = requirements;
+    if ((flags & vk::MemoryPropertyFlagBits::eHostVisible) && !(flags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+        req.alignment = std::max(req.alignment, _nonCoherentAtomSize);
+        req.size = utils::roundUpToMultipleOf(req.size, _nonCoherentAtomSize);
+    }
+
+    std::scoped_lock lock{ _mutex };
+    auto& blocks = _blocks[memoryTypeIndex * 2u + optimalTiling];
+    vk::DeviceSize offset = 0;
+    uint32_t node = Tlsf::nil;
+    MemoryBlock* block = nullptr;
+    for (const auto& b : blocks) {
+        if (b->evacuating) continue;
+        node = b->tlsf.allocate(req.size, req.alignment, offset);
+        if (node != Tlsf::nil) { block = b.get(); break; }
+    }
+    if (!block && !mayGrow) return {};
+    if (!block) {
+        constexpr vk::MemoryAllocateFlagsInfo memoryAllocateFlagsInfo{ vk::MemoryAllocateFlagBits::eDeviceAddress };
+        const vk::MemoryAllocateInfo memoryAllocateInfo{ bSize, memoryTypeIndex, &memoryAllocateFlagsInfo };
+        block = blocks.emplace_back(std::make_unique<MemoryBlock>(_device, memoryAllocateInfo, false, optimalTiling)).get();
+        block->id = _nextBlockId++;
+        trackBlock(*block, true);
+        node = block->tlsf.allocate(req.size, req.alignment, offset);
+        if (node == Tlsf::nil) throw std::runtime_error{ "Allocation does not fit into an empty memory block" };
+    }
+
+    Allocation allocation;
+    allocation.deviceMemory = *block->memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation._allocator = this;
+    allocation._block = block;
+    allocation._node = node;
+    allocation._tag = tagIndex(tag);
+    track(allocation, true);
+    return allocation;
+}
+
+Allocation MemoryAllocator::allocateDedicated(const vk::MemoryRequirements& requirements, const uint32_t memoryTypeIndex, const void* pNext, const std::string_view tag)
+{
+    const vk::MemoryAllocateFlagsInfo memoryAllocateFlagsInfo{ vk::MemoryAllocateFlagBits::eDeviceAddress, {}, pNext };
+    const vk::MemoryAllocateInfo memoryAllocateInfo{ requirements.size, memoryTypeIndex, &memoryAllocateFlagsInfo };
+    auto* block = new MemoryBlock{ _device, memoryAllocateInfo, true };
+
+    std::scoped_lock lock{ _mutex };
+    trackBlock(*block, true);
+
+    Allocation allocation;
+    allocation.deviceMemory = *block->memory;
+    allocation.offset = 0;
+    allocation.size = requirements.size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation._allocator = this;
+    allocation._block = block;
+    allocation._tag = tagIndex(tag);
+    track(allocation, true);
+    return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation)
+{
+    allocation.unmap();
+    MemoryBlock* block = std::exchange(allocation._block, nullptr);
+    allocation._allocator = nullptr;
+    if (!block) return;
+
+    std::scoped_lock lock{ _mutex };
+    track(allocation, false);
+    if (block->dedicated) {
+        trackBlock(*block, false);
+        delete block;
+        return;
+    }
+    block->tlsf.free(std::exchange(allocation._node, Tlsf::nil));
+    if (!block->tlsf.empty()) return;
+    // keep one empty block per memory type around so alternating create/destroy does not hit the driver
+    auto& blocks = _blocks[allocation.memoryTypeIndex * 2u + block->optimalTiling];
+    const auto emptyBlocks = std::ranges::count_if(blocks, [](const auto& b) { return b->tlsf.empty(); });
+    if (emptyBlocks > 1 || block->evacuating) {
+        trackBlock(*block, false);
+        std::erase_if(blocks, [block](const auto& b) { return b.get() == block; });
+    }
+}
+
+void MemoryAllocator::releaseEmptyBlocks()
+{
+    std::scoped_lock lock{ _mutex };
+    for (auto& blocks : _blocks) {
+        std::erase_if(blocks, [this](const auto& b) {
+            if (!b->tlsf.empty()) return false;
+            trackBlock(*b, false);
+            return true;
+        });
+    }
+}
+
+MemoryStats MemoryAllocator::stats()
+{
+    std::scoped_lock lock{ _mutex };
+    return { _heapStats, _tagStats };
+}
+
+uint32_t MemoryAllocator::tagIndex(const std::string_view tag)
+{
+    if (tag.empty()) return 0;
+    for (uint32_t i = 1; i < _tagStats.size(); i++) if (_tagStats[i].tag == tag) return i;
+    _tagStats.push_back({ std::string{ tag }, std::vector<MemoryUsage>(_heapStats.size()), {} });
+    return static_cast<uint32_t>(_tagStats.size() - 1u);
+}
+
+void MemoryAllocator::track(const Allocation& allocation, const bool add)
+{
+    const uint32_t heapIndex = _memoryProperties.memoryTypes[allocation.memoryTypeIndex].heapIndex;
+    auto& heap = _heapStats[heapIndex];
+    auto& tag = _tagStats[allocation._tag];
+    if (add) {
+        heap.allocations.add(allocation.size);
+        heap.allocationCount++;
+        tag.heaps[heapIndex].add(allocation.size);
+        tag.total.add(allocation.size);
+    } else {
+        heap.allocations.sub(allocation.size);
+        heap.allocationCount--;
+        tag.heaps[heapIndex].sub(allocation.size);
+        tag.total.sub(allocation.size);
+    }
+}
+
+void MemoryAllocator::trackBlock(const MemoryBlock& block, const bool add)
+{
+    auto& heap = _heapStats[_memoryProperties.memoryTypes[block.memoryTypeIndex].heapIndex];
+    if (add) {
+        heap.blocks.add(block.size);
+        heap.blockCount++;
+    } else {
+        heap.blocks.sub(block.size);
+        heap.blockCount--;
+    }
+}
+
+void* MemoryAllocator::map(MemoryBlock& block)
+{
+    std::scoped_lock lock{ _mutex };
+    if (!(_memoryProperties.memoryTypes[block.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)) {
+        throw std::runtime_error{ "Memory is not host visible" };
+    }
+    if (block.mapCount++ == 0) block.mapped = block.memory.mapMemory(0, vk::WholeSize);
+    return block.mapped;
+}
+
+void MemoryAllocator::unmap(MemoryBlock& block)
+{
+    std::scoped_lock lock{ _mutex };
+    if (block.mapCount == 0) return;
+    if (--block.mapCount == 0) {
+        block.memory.unmapMemory();
+        block.mapped = nullptr;
+    }
+}
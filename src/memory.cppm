@@ -0,0 +1,174 @@
+module;
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <array>
+#include <limits>
+#include <string>
+#include <string_view>
+export module evk:memory;
+import :utils;
+import vulkan;
+
+export namespace evk
+{
+    // Two level segregated fit (TLSF) bookkeeping for one memory block, O(1) allocate and free
+    // https://www.researchgate.net/publication/4080369_TLSF_a_new_dynamic_memory_allocator_for_real-time_systems
+    struct Tlsf
+    {
+        static constexpr uint32_t nil = std::numeric_limits<uint32_t>::max();
+        static constexpr uint32_t slLog2 = 4;
+        static constexpr uint32_t slCount = 1u << slLog2;
+        static constexpr uint32_t flCount = 64u - slLog2 + 1u;
+
+        struct Node
+        {
+            vk::DeviceSize offset, size;
+            uint32_t prevPhys, nextPhys; // neighbours in address order
+            uint32_t prevFree, nextFree; // neighbours in the free list of the size class
+            bool free;
+        };
+
+        EVK_API Tlsf() = default;
+        EVK_API explicit Tlsf(vk::DeviceSize size);
+
+        // returns the node index of the allocation and writes its aligned offset, nil if nothing fits
+        [[nodiscard]] EVK_API uint32_t allocate(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset);
+        EVK_API void free(uint32_t node);
+
+        [[nodiscard]] EVK_API bool empty() const { return allocationCount == 0; }
+
+        std::vector<Node> _nodes;
+        std::vector<uint32_t> _unusedNodes;
+        std::array<std::array<uint32_t, slCount>, flCount> _freeLists;
+        std::array<uint32_t, flCount> _slBitmap;
+        uint64_t _flBitmap = 0;
+
+        vk::DeviceSize size = 0;
+        vk::DeviceSize allocatedBytes = 0;
+        uint32_t allocationCount = 0;
+    private:
+        uint32_t newNode(const Node& node);
+        void insertFree(uint32_t node);
+        void removeFree(uint32_t node);
+        uint32_t findFree(vk::DeviceSize size) const;
+    };
+
+    // One vkAllocateMemory, either shared by many sub-allocations or dedicated to a single resource
+    struct MemoryBlock
+    {
+        EVK_API MemoryBlock(const vk::raii::Device& device, const vk::MemoryAllocateInfo& allocateInfo, bool dedicated, bool optimalTiling = false);
+
+        vk::raii::DeviceMemory memory;
+        vk::DeviceSize size;
+        uint32_t memoryTypeIndex;
+        bool dedicated;
+        bool optimalTiling; // holds optimal tiling images only, so bufferImageGranularity never has to be respected
+        bool evacuating = false; // being emptied by the defragmenter, no new allocations are placed inside
+        uint64_t id = 0; // never reused by the allocator, unlike the address of a freed block
+        // host mapping of the whole block, shared by all allocations inside
+        void* mapped = nullptr;
+        uint32_t mapCount = 0;
+        Tlsf tlsf;
+    };
+
+    struct MemoryUsage
+    {
+        vk::DeviceSize current = 0, peak = 0;
+        EVK_API void add(const vk::DeviceSize bytes) { current += bytes; peak = std::max(peak, current); }
+        EVK_API void sub(const vk::DeviceSize bytes) { current -= bytes; }
+    };
+    struct MemoryHeapStats
+    {
+        vk::DeviceSize size = 0;
+        // VK_EXT_memory_budget values for the whole process, without the extension the heap size and evk's own blocks
+        vk::DeviceSize budget = 0, usage = 0;
+        MemoryUsage blocks; // vkAllocateMemory done by evk
+        MemoryUsage allocations; // bytes of the resources inside the blocks
+        uint32_t blockCount = 0, allocationCount = 0;
+    };
+    struct MemoryTagStats
+    {
+        std::string tag; // empty for untagged allocations
+        std::vector<MemoryUsage> heaps;
+        MemoryUsage total;
+    };
+    struct MemoryStats
+    {
+        std::vector<MemoryHeapStats> heaps;
+        std::vector<MemoryTagStats> tags;
+    };
+
+    struct MemoryAllocator;
+    // (memory, offset) of a resource, returned to its block on destruction
+    struct Allocation
+    {
+        EVK_API Allocation() = default;
+        EVK_API Allocation(const Allocation&) = delete;
+        EVK_API Allocation(Allocation&& other) noexcept;
+        EVK_API Allocation& operator=(const Allocation&) = delete;
+        EVK_API Allocation& operator=(Allocation&& other) noexcept;
+        EVK_API ~Allocation();
+
+        // pointer to the first byte of this allocation, the block is mapped once for all allocations inside
+        // and stays mapped until every allocation that mapped it called unmap or was freed
+        [[nodiscard]] EVK_API void* map();
+        EVK_API void unmap();
+        [[nodiscard]] EVK_API bool dedicated() const { return _block && _block->dedicated; }
+
+        EVK_API const vk::DeviceMemory& operator*() const { return deviceMemory; }
+        EVK_API operator bool() const { return _block; }
+
+        vk::DeviceMemory deviceMemory;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        uint32_t memoryTypeIndex = 0;
+        void* mapped = nullptr;
+
+        MemoryAllocator* _allocator = nullptr;
+        MemoryBlock* _block = nullptr;
+        uint32_t _node = Tlsf::nil;
+        uint32_t _tag = 0;
+    };
+
+    // Per memory type pool of blocks, resources are sub-allocated unless they are large or ask for their own memory
+    struct MemoryAllocator
+    {
+        EVK_API MemoryAllocator(const vk::raii::Device& device, const vk::PhysicalDeviceMemoryProperties& memoryProperties, vk::DeviceSize nonCoherentAtomSize);
+
+        // optimal tiling images are kept apart from buffers and linear images, tag groups allocations in stats() (e.g. "blas", "imgui")
+        [[nodiscard]] EVK_API Allocation allocate(const vk::MemoryRequirements& requirements, uint32_t memoryTypeIndex, bool optimalTiling = false, std::string_view tag = {});
+        // sub-allocation from the existing blocks only, empty if nothing fits
+        [[nodiscard]] EVK_API Allocation tryAllocate(const vk::MemoryRequirements& requirements, uint32_t memoryTypeIndex, bool optimalTiling = false, std::string_view tag = {});
+        // pNext is chained behind the allocation flags, e.g. for vk::ExportMemoryAllocateInfo or vk::MemoryDedicatedAllocateInfo
+        [[nodiscard]] EVK_API Allocation allocateDedicated(const vk::MemoryRequirements& requirements, uint32_t memoryTypeIndex, const void* pNext = nullptr, std::string_view tag = {});
+        EVK_API void free(Allocation& allocation);
+        // gives every empty block back to the driver, including the one free() keeps around
+        EVK_API void releaseEmptyBlocks();
+
+        // per heap and per tag usage of this allocator, budget/usage are left to Device::memoryStats
+        [[nodiscard]] EVK_API MemoryStats stats();
+
+        EVK_API void* map(MemoryBlock& block);
+        EVK_API void unmap(MemoryBlock& block);
+
+        [[nodiscard]] EVK_API vk::DeviceSize blockSize(uint32_t memoryTypeIndex) const;
+
+        const vk::raii::Device& _device;
+        vk::PhysicalDeviceMemoryProperties _memoryProperties;
+        vk::DeviceSize _nonCoherentAtomSize;
+        std::vector<std::vector<std::unique_ptr<MemoryBlock>>> _blocks; // [memoryTypeIndex * 2 + optimalTiling][block], dedicated blocks are owned by their allocation
+        std::vector<MemoryHeapStats> _heapStats;
+        std::vector<MemoryTagStats> _tagStats; // [0] is the untagged bucket
+        uint64_t _nextBlockId = 1;
+        std::mutex _mutex;
+    private:
+        Allocation subAllocate(const vk::MemoryRequirements& requirements, uint32_t memoryTypeIndex, bool optimalTiling, std::string_view tag, bool mayGrow);
+        // callers hold _mutex
+        uint32_t tagIndex(std::string_view tag);
+        void track(const Allocation& allocation, bool add);
+        void trackBlock(const MemoryBlock& block, bool add);
+    };
+}
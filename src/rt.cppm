@@ -59,7 +59,7 @@ export namespace evk::rt {
 			const ShaderSpecialization& specialization = {},
 			const std::vector<vk::DescriptorSetLayout>& descriptorSetLayouts = {}
 		) : Resource{ device }, layout{ *dev, vk::PipelineLayoutCreateInfo{}.setPushConstantRanges(pcRanges).setSetLayouts(descriptorSetLayouts) }, pipeline{ nullptr },
-			_sbtBuffer{ device,  sbt.sizeInBytes, vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal } {
+			_sbtBuffer{ device,  sbt.sizeInBytes, vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "sbt" } {
 
 			std::vector<vk::PipelineShaderStageCreateInfo> shaderStages{ stages.size() };
 			for (auto i = 0; i < stages.size(); i++) {
@@ -76,7 +76,7 @@ export namespace evk::rt {
 				const auto shaderHandleStorageSize = shaderGroupHandleSize * sbt.shaderGroupCreateInfos.size();
 				const auto shaderHandleStorage = pipeline.getRayTracingShaderGroupHandlesKHR<uint8_t>(0, sbt.shaderGroupCreateInfos.size(), shaderHandleStorageSize);
 
-				uint8_t* ptr = static_cast<uint8_t*>(_sbtBuffer.memory.mapMemory(0, vk::WholeSize));
+				uint8_t* ptr = _sbtBuffer.data<uint8_t>().data();
 
 				uint32_t shaderHandleStorageOffset = 0;
 				for (auto rgen : sbt.rgenRegions) {
@@ -104,7 +104,8 @@ export namespace evk::rt {
 						shaderHandleStorageOffset += shaderGroupHandleSize;
 					}
 				}
-				_sbtBuffer.memory.unmapMemory();
+				_sbtBuffer.markDirty();
+				_sbtBuffer.flush();
 
 				_rgenRegions = sbt.rgenRegions;
 				_missRegion = sbt.missRegion;
@@ -260,11 +261,11 @@ export namespace evk::rt {
 	    {
 			if (!scratchBuffer)
 			{
-				scratchBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.buildScratchSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal), 0 };
+				scratchBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.buildScratchSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "as_scratch"), 0 };
 			}
             if (!accelerationStructureBuffer)
             {
-				accelerationStructureBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.accelerationStructureSize, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal), 0 };
+				accelerationStructureBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.accelerationStructureSize, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "blas"), 0 };
 			}
             if (accelerationStructureBuffer.offset % 256 != 0) throw std::runtime_error("Acceleration structure buffer offset must be a multiple of 256");
 
@@ -335,11 +336,11 @@ export namespace evk::rt {
 		{
 			if (!scratchBuffer)
 			{
-				scratchBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.buildScratchSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal), 0 };
+				scratchBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.buildScratchSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "as_scratch"), 0 };
 			}
 			if (!accelerationStructureBuffer)
 			{
-				accelerationStructureBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.accelerationStructureSize, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal), 0 };
+				accelerationStructureBuffer = { evk::make_shared<evk::Buffer>(device, buildSizesInfo.accelerationStructureSize, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, false, false, "tlas"), 0 };
 			}
 			if (accelerationStructureBuffer.offset % 256 != 0) throw std::runtime_error("Acceleration structure buffer offset must be a multiple of 256");
 
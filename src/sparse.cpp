@@ -0,0 +1,303 @@
+module;
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+module evk;
+import :sparse;
+import :core;
+import :utils;
+using namespace evk;
+
+namespace
+{
+    // one sparse block, aligned so it can be bound at any page of the resource
+    Allocation allocatePages(const Device& device, const vk::DeviceSize size, const vk::DeviceSize pageSize, const uint32_t memoryTypeIndex, const bool optimalTiling, const std::string_view tag)
+    {
+        return device.allocator->allocate({ size, pageSize, 1u << memoryTypeIndex }, memoryTypeIndex, optimalTiling, tag);
+    }
+
+    uint32_t tilesOf(const uint32_t texels, const uint32_t tileTexels) { return (texels + tileTexels - 1u) / tileTexels; }
+}
+
+SparseBuffer::SparseBuffer(
+    const evk::SharedPtr<Device>& device,
+    const vk::DeviceSize size,
+    const vk::BufferUsageFlags usageFlags,
+    const vk::MemoryPropertyFlags memoryPropertyFlags,
+    const std::string_view tag,
+    const bool residency
+) : Resource{ device }, buffer{ nullptr }, size{ size }, _tag{ tag.empty() ? std::string_view{ "sparse" } : tag }
+{
+    if (!dev->enabledFeatures.sparseBinding) throw std::runtime_error{ "Sparse buffers need the sparseBinding feature" };
+    if (residency && !dev->enabledFeatures.sparseResidencyBuffer) throw std::runtime_error{ "Partially resident sparse buffers need the sparseResidencyBuffer feature" };
+    vk::BufferCreateFlags createFlags = vk::BufferCreateFlagBits::eSparseBinding;
+    if (residency) createFlags |= vk::BufferCreateFlagBits::eSparseResidency;
+    buffer = vk::raii::Buffer{ *dev, { createFlags, size, usageFlags, vk::SharingMode::eExclusive } };
+    if (usageFlags & vk::BufferUsageFlagBits::eShaderDeviceAddress) deviceAddress = dev->getBufferAddress({ *buffer });
+
+    const auto memoryRequirements = buffer.getMemoryRequirements();
+    pageSize = memoryRequirements.alignment;
+    pages.resize((memoryRequirements.size + pageSize - 1u) / pageSize);
+    _memoryTypeIndex = dev->selectMemoryType({ pageSize, pageSize, memoryRequirements.memoryTypeBits }, memoryPropertyFlags);
+}
+
+void SparseBuffer::bind(const vk::DeviceSize byteOffset, const vk::DeviceSize byteSize)
+{
+    if (byteSize == 0) return;
+    if (byteOffset + byteSize > size) throw std::out_of_range{ "Sparse bind exceeds buffer size" };
+    for (size_t page = byteOffset / pageSize; page <= (byteOffset + byteSize - 1u) / pageSize; page++) {
+        if (pages[page]) continue;
+        pages[page] = allocatePages(*dev, pageSize, pageSize, _memoryTypeIndex, false, _tag);
+        _pending[page] = vk::SparseMemoryBind{ page * pageSize, pageSize, *pages[page], pages[page].offset };
+    }
+}
+
+void SparseBuffer::unbind(const vk::DeviceSize byteOffset, const vk::DeviceSize byteSize)
+{
+    if (byteSize == 0) return;
+    if (byteOffset + byteSize > size) throw std::out_of_range{ "Sparse unbind exceeds buffer size" };
+    for (size_t page = byteOffset / pageSize; page <= (byteOffset + byteSize - 1u) / pageSize; page++) {
+        if (!pages[page]) continue;
+        _released.emplace_back(std::move(pages[page]));
+        pages[page] = {};
+        _pending[page] = vk::SparseMemoryBind{ page * pageSize, pageSize, nullptr, 0 };
+    }
+}
+
+size_t SparseBuffer::residentPages() const
+{
+    return std::ranges::count_if(pages, [](const Allocation& page) { return static_cast<bool>(page); });
+}
+
+SparseImage::SparseImage(
+    const evk::SharedPtr<Device>& device,
+    const vk::Extent3D extent,
+    const vk::Format format,
+    const vk::ImageUsageFlags usageFlags,
+    const uint32_t mipLevels,
+    const uint32_t arrayLayers,
+    const std::string_view tag
+) : Resource{ device }, image{ nullptr }, imageView{ nullptr }, extent{ extent }, format{ format }, aspectMask{ utils::formatToAspectMask(format) },
+    mipLevels{ std::max(mipLevels, 1u) }, arrayLayers{ std::max(arrayLayers, 1u) }, mipTailFirstLod{ 0 }, _tag{ tag.empty() ? std::string_view{ "sparse" } : tag }
+{
+    if (this->extent.height == 0) this->extent.height = 1;
+    if (this->extent.depth == 0) this->extent.depth = 1;
+    const vk::ImageType imageType = utils::extentToImageType(this->extent);
+    if (!dev->enabledFeatures.sparseBinding) throw std::runtime_error{ "Sparse images need the sparseBinding feature" };
+    if (imageType == vk::ImageType::e1D) throw std::invalid_argument{ "1D images can not be sparse resident" };
+    if (imageType == vk::ImageType::e2D && !dev->enabledFeatures.sparseResidencyImage2D) throw std::runtime_error{ "Sparse 2D images need the sparseResidencyImage2D feature" };
+    if (imageType == vk::ImageType::e3D && !dev->enabledFeatures.sparseResidencyImage3D) throw std::runtime_error{ "Sparse 3D images need the sparseResidencyImage3D feature" };
+    constexpr vk::ImageCreateFlags createFlags = vk::ImageCreateFlagBits::eSparseBinding | vk::ImageCreateFlagBits::eSparseResidency;
+    const vk::ImageCreateInfo createInfo{ createFlags, imageType, format, this->extent,
+        this->mipLevels, this->arrayLayers, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal, usageFlags };
+    image = vk::raii::Image{ *dev, createInfo };
+
+    const auto memoryRequirements = image.getMemoryRequirements();
+    pageSize = memoryRequirements.alignment;
+    _memoryTypeIndex = dev->selectMemoryType({ pageSize, pageSize, memoryRequirements.memoryTypeBits }, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    // the mip tail and metadata can not be bound per tile, they stay resident for the lifetime of the image
+    const auto sparseRequirements = image.getSparseMemoryRequirements();
+    bool hasColor = false;
+    for (const vk::SparseImageMemoryRequirements& req : sparseRequirements) {
+        const bool metadata = static_cast<bool>(req.formatProperties.aspectMask & vk::ImageAspectFlagBits::eMetadata);
+        if (!metadata) {
+            hasColor = true;
+            tileExtent = req.formatProperties.imageGranularity;
+            mipTailFirstLod = std::min(req.imageMipTailFirstLod, this->mipLevels);
+        }
+        if (!metadata && mipTailFirstLod >= this->mipLevels) continue;
+        const bool singleTail = static_cast<bool>(req.formatProperties.flags & vk::SparseImageFormatFlagBits::eSingleMiptail);
+        for (uint32_t layer = 0; layer < (singleTail ? 1u : this->arrayLayers); layer++) {
+            auto& tailMemory = tail.emplace_back(allocatePages(*dev, req.imageMipTailSize, pageSize, _memoryTypeIndex, true, _tag));
+            _pendingOpaque.emplace_back(req.imageMipTailOffset + layer * req.imageMipTailStride, req.imageMipTailSize, *tailMemory, tailMemory.offset,
+                metadata ? vk::SparseMemoryBindFlagBits::eMetadata : vk::SparseMemoryBindFlags{});
+        }
+    }
+    if (!hasColor) throw std::runtime_error{ "Format has no sparse image layout" };
+
+    _firstPage.resize(static_cast<size_t>(this->arrayLayers) * mipTailFirstLod + 1u);
+    size_t pageCount = 0;
+    for (uint32_t layer = 0; layer < this->arrayLayers; layer++) {
+        for (uint32_t mip = 0; mip < mipTailFirstLod; mip++) {
+            _firstPage[layer * mipTailFirstLod + mip] = pageCount;
+            const vk::Extent3D grid = tileGrid(mip);
+            pageCount += static_cast<size_t>(grid.width) * grid.height * grid.depth;
+        }
+    }
+    _firstPage.back() = pageCount;
+    pages.resize(pageCount);
+
+    vk::ImageViewType viewType = utils::extentToImageViewType(this->extent);
+    if (this->arrayLayers > 1u) viewType = viewType == vk::ImageViewType::e1D ? vk::ImageViewType::e1DArray : vk::ImageViewType::e2DArray;
+    // unbound tiles read as undefined (or zero with residencyNonResidentStrict), the view does not need any memory
+    imageView = vk::raii::ImageView{ *dev, vk::ImageViewCreateInfo{ {}, *image, viewType, format, {}, { aspectMask, 0, this->mipLevels, 0, this->arrayLayers } } };
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.image = *image;
+    barrier.subresourceRange = { aspectMask, 0, this->mipLevels, 0, this->arrayLayers };
+}
+
+vk::Extent3D SparseImage::tileGrid(const uint32_t mipLevel) const
+{
+    if (mipLevel >= mipTailFirstLod) return { 0, 0, 0 };
+    return {
+        tilesOf(std::max(extent.width >> mipLevel, 1u), tileExtent.width),
+        tilesOf(std::max(extent.height >> mipLevel, 1u), tileExtent.height),
+        tilesOf(std::max(extent.depth >> mipLevel, 1u), tileExtent.depth)
+    };
+}
+
+size_t SparseImage::_pageIndex(const uint32_t mipLevel, const uint32_t layer, const vk::Offset3D tile) const
+{
+    const vk::Extent3D grid = tileGrid(mipLevel);
+    if (layer >= arrayLayers || tile.x < 0 || tile.y < 0 || tile.z < 0
+        || static_cast<uint32_t>(tile.x) >= grid.width || static_cast<uint32_t>(tile.y) >= grid.height || static_cast<uint32_t>(tile.z) >= grid.depth) {
+        throw std::out_of_range{ "Sparse tile out of range" };
+    }
+    return _firstPage[layer * mipTailFirstLod + mipLevel] + (static_cast<size_t>(tile.z) * grid.height + tile.y) * grid.width + tile.x;
+}
+
+bool SparseImage::isResident(const uint32_t mipLevel, const uint32_t layer, const vk::Offset3D tile) const
+{
+    if (mipLevel >= mipTailFirstLod) return mipLevel < mipLevels;
+    return static_cast<bool>(pages[_pageIndex(mipLevel, layer, tile)]);
+}
+
+void SparseImage::bind(const uint32_t mipLevel, const uint32_t layer, const vk::Offset3D tile, const vk::Extent3D tileCount)
+{
+    _setTiles(mipLevel, layer, tile, tileCount, true);
+}
+
+void SparseImage::unbind(const uint32_t mipLevel, const uint32_t layer, const vk::Offset3D tile, const vk::Extent3D tileCount)
+{
+    _setTiles(mipLevel, layer, tile, tileCount, false);
+}
+
+void SparseImage::_setTiles(const uint32_t mipLevel, const uint32_t layer, const vk::Offset3D tile, const vk::Extent3D tileCount, const bool resident)
+{
+    // the tail is always resident
+    if (mipLevel >= mipTailFirstLod) return;
+    const vk::Extent3D mipExtent{ std::max(extent.width >> mipLevel, 1u), std::max(extent.height >> mipLevel, 1u), std::max(extent.depth >> mipLevel, 1u) };
+    for (int32_t z = tile.z; z < tile.z + static_cast<int32_t>(tileCount.depth); z++) {
+        for (int32_t y = tile.y; y < tile.y + static_cast<int32_t>(tileCount.height); y++) {
+            for (int32_t x = tile.x; x < tile.x + static_cast<int32_t>(tileCount.width); x++) {
+                const size_t page = _pageIndex(mipLevel, layer, { x, y, z });
+                if (static_cast<bool>(pages[page]) == resident) continue;
+                if (resident) pages[page] = allocatePages(*dev, pageSize, pageSize, _memoryTypeIndex, true, _tag);
+                else {
+                    _released.emplace_back(std::move(pages[page]));
+                    pages[page] = {};
+                }
+                // edge tiles are clamped to the mip extent
+                const vk::Offset3D offset{ x * static_cast<int32_t>(tileExtent.width), y * static_cast<int32_t>(tileExtent.height), z * static_cast<int32_t>(tileExtent.depth) };
+                const vk::Extent3D bindExtent{
+                    std::min(tileExtent.width, mipExtent.width - offset.x),
+                    std::min(tileExtent.height, mipExtent.height - offset.y),
+                    std::min(tileExtent.depth, mipExtent.depth - offset.z)
+                };
+                _pending[page] = vk::SparseImageMemoryBind{ { aspectMask, mipLevel, layer }, offset, bindExtent,
+                    resident ? *pages[page] : vk::DeviceMemory{}, resident ? pages[page].offset : 0 };
+            }
+        }
+    }
+}
+
+SparseBinder::SparseBinder(const evk::SharedPtr<Device>& device, const Device::QueueFamily queueFamily, const Device::QueueCount queueIndex) :
+    Resource{ device }, queue{ &dev->getQueue(queueFamily, queueIndex) }, semaphore{ nullptr }
+{
+    if (!(dev->physicalDevice.getQueueFamilyProperties()[queueFamily].queueFlags & vk::QueueFlagBits::eSparseBinding)) throw std::runtime_error{ "Queue family does not support sparse binding" };
+    const vk::SemaphoreTypeCreateInfo semaphoreTypeCreateInfo{ vk::SemaphoreType::eTimeline, 0 };
+    semaphore = vk::raii::Semaphore{ *dev, vk::SemaphoreCreateInfo{ {}, &semaphoreTypeCreateInfo } };
+}
+
+SparseBinder::~SparseBinder()
+{
+    if (!*semaphore) return;
+    wait({ _nextValue - 1u });
+}
+
+SparseBinder::Ticket SparseBinder::commit(
+    const std::span<SparseBuffer* const> buffers,
+    const std::span<SparseImage* const> images,
+    const std::span<const std::pair<vk::Semaphore, uint64_t>> waits
+)
+{
+    const uint64_t completed = semaphore.getCounterValue();
+    while (!_garbage.empty() && _garbage.front().first <= completed) _garbage.pop_front();
+
+    // the bind arrays are referenced by the bind infos, reserved so they never move
+    std::vector<std::vector<vk::SparseMemoryBind>> memoryBinds;
+    std::vector<std::vector<vk::SparseImageMemoryBind>> imageBinds;
+    memoryBinds.reserve(buffers.size() + images.size());
+    imageBinds.reserve(images.size());
+    std::vector<vk::SparseBufferMemoryBindInfo> bufferInfos;
+    std::vector<vk::SparseImageOpaqueMemoryBindInfo> opaqueInfos;
+    std::vector<vk::SparseImageMemoryBindInfo> imageInfos;
+    std::vector<Allocation> released;
+
+    for (SparseBuffer* buffer : buffers) {
+        if (!buffer->_pending.empty()) {
+            auto& binds = memoryBinds.emplace_back();
+            binds.reserve(buffer->_pending.size());
+            for (const auto& bind : buffer->_pending | std::views::values) binds.push_back(bind);
+            bufferInfos.emplace_back(*buffer->buffer, binds);
+            buffer->_pending.clear();
+        }
+        std::ranges::move(buffer->_released, std::back_inserter(released));
+        buffer->_released.clear();
+    }
+    for (SparseImage* image : images) {
+        if (!image->_pendingOpaque.empty()) {
+            auto& binds = memoryBinds.emplace_back(std::move(image->_pendingOpaque));
+            opaqueInfos.emplace_back(*image->image, binds);
+            image->_pendingOpaque.clear();
+        }
+        if (!image->_pending.empty()) {
+            auto& binds = imageBinds.emplace_back();
+            binds.reserve(image->_pending.size());
+            for (const auto& bind : image->_pending | std::views::values) binds.push_back(bind);
+            imageInfos.emplace_back(*image->image, binds);
+            image->_pending.clear();
+        }
+        std::ranges::move(image->_released, std::back_inserter(released));
+        image->_released.clear();
+    }
+
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<uint64_t> waitValues;
+    for (const auto& [waitSemaphore, value] : waits) {
+        waitSemaphores.push_back(waitSemaphore);
+        waitValues.push_back(value);
+    }
+    const uint64_t value = _nextValue++;
+    const vk::Semaphore signalSemaphore = *semaphore;
+    const auto timelineInfo = vk::TimelineSemaphoreSubmitInfo{}.setWaitSemaphoreValues(waitValues).setSignalSemaphoreValues(value);
+    const auto bindInfo = vk::BindSparseInfo{}
+        .setPNext(&timelineInfo)
+        .setWaitSemaphores(waitSemaphores)
+        .setBufferBinds(bufferInfos)
+        .setImageOpaqueBinds(opaqueInfos)
+        .setImageBinds(imageInfos)
+        .setSignalSemaphores(signalSemaphore);
+    queue->bindSparse(bindInfo);
+
+    if (!released.empty()) _garbage.emplace_back(value, std::move(released));
+    return { value };
+}
+
+bool SparseBinder::isComplete(const Ticket ticket) const
+{
+    return semaphore.getCounterValue() >= ticket.value;
+}
+
+bool SparseBinder::wait(const Ticket ticket, const uint64_t timeout) const
+{
+    return dev->waitSemaphores(vk::SemaphoreWaitInfo{ {}, *semaphore, ticket.value }, timeout) == vk::Result::eSuccess;
+}
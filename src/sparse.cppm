@@ -0,0 +1,129 @@
+module;
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+export module evk:sparse;
+import :utils;
+import :memory;
+import :core;
+import vulkan;
+
+export namespace evk
+{
+    // Buffer with a virtual address range whose pages get memory only when bound. Binds and unbinds are recorded here and
+    // applied by SparseBinder::commit. Needs the sparseBinding feature. Without residency every page has to be bound while the
+    // device uses the buffer, with it unbound pages may stay unbound (needs sparseResidencyBuffer)
+    struct SparseBuffer : Resource, Shareable<SparseBuffer>
+    {
+        EVK_API SparseBuffer() : Resource{ nullptr }, buffer{ nullptr } {}
+        EVK_API SparseBuffer(
+            const evk::SharedPtr<Device>& device,
+            vk::DeviceSize size,
+            vk::BufferUsageFlags usageFlags,
+            vk::MemoryPropertyFlags memoryPropertyFlags = vk::MemoryPropertyFlagBits::eDeviceLocal,
+            std::string_view tag = {},
+            bool residency = false // eSparseResidency, partially bound use
+        );
+
+        // every page touching [offset, offset + size)
+        EVK_API void bind(vk::DeviceSize byteOffset, vk::DeviceSize byteSize);
+        EVK_API void unbind(vk::DeviceSize byteOffset, vk::DeviceSize byteSize);
+        [[nodiscard]] EVK_API bool isResident(const size_t page) const { return static_cast<bool>(pages[page]); }
+        [[nodiscard]] EVK_API size_t residentPages() const;
+
+        vk::raii::Buffer buffer;
+        vk::DeviceAddress deviceAddress = 0;
+        vk::DeviceSize size = 0;
+        vk::DeviceSize pageSize = 0;
+        std::vector<evk::Allocation> pages; // page table, empty = not resident
+
+        uint32_t _memoryTypeIndex = 0;
+        std::string _tag;
+        std::map<size_t, vk::SparseMemoryBind> _pending; // [page], the last bind/unbind of a page wins
+        std::vector<evk::Allocation> _released; // unbound pages, freed once the commit that unbinds them completes
+    };
+
+    // Image whose tiles get memory only when bound, the mip tail (and metadata) is always resident. Tiles are addressed in tile
+    // coordinates of a mip, a tile covers tileExtent texels. Needs the sparseBinding and sparseResidencyImage2D/3D features
+    struct SparseImage : Resource, Shareable<SparseImage>
+    {
+        EVK_API SparseImage() : Resource{ nullptr }, image{ nullptr }, imageView{ nullptr } {}
+        EVK_API SparseImage(
+            const evk::SharedPtr<Device>& device,
+            vk::Extent3D extent,
+            vk::Format format,
+            vk::ImageUsageFlags usageFlags,
+            uint32_t mipLevels = 1,
+            uint32_t arrayLayers = 1,
+            std::string_view tag = {}
+        );
+
+        EVK_API void bind(uint32_t mipLevel, uint32_t layer, vk::Offset3D tile, vk::Extent3D tileCount = { 1, 1, 1 });
+        EVK_API void unbind(uint32_t mipLevel, uint32_t layer, vk::Offset3D tile, vk::Extent3D tileCount = { 1, 1, 1 });
+        [[nodiscard]] EVK_API bool isResident(uint32_t mipLevel, uint32_t layer, vk::Offset3D tile) const;
+        // tiles of a mip below the mip tail
+        [[nodiscard]] EVK_API vk::Extent3D tileGrid(uint32_t mipLevel) const;
+
+        vk::raii::Image image;
+        vk::raii::ImageView imageView;
+        vk::Extent3D extent;
+        vk::Format format;
+        vk::ImageAspectFlags aspectMask;
+        uint32_t mipLevels, arrayLayers;
+        uint32_t mipTailFirstLod; // mips from here on live in the always resident tail
+        vk::Extent3D tileExtent;
+        vk::DeviceSize pageSize = 0;
+        std::vector<evk::Allocation> pages; // page table of all tiles below the tail, [layer][mip][z][y][x]
+        std::vector<evk::Allocation> tail; // mip tail and metadata
+        evk::ImageMemoryBarrier2 barrier;
+
+        [[nodiscard]] size_t _pageIndex(uint32_t mipLevel, uint32_t layer, vk::Offset3D tile) const;
+        void _setTiles(uint32_t mipLevel, uint32_t layer, vk::Offset3D tile, vk::Extent3D tileCount, bool resident);
+
+        uint32_t _memoryTypeIndex = 0;
+        std::string _tag;
+        std::vector<size_t> _firstPage; // [layer * mipTailFirstLod + mip]
+        std::map<size_t, vk::SparseImageMemoryBind> _pending;
+        std::vector<vk::SparseMemoryBind> _pendingOpaque;
+        std::vector<evk::Allocation> _released;
+    };
+
+    // Applies the pending binds of many sparse resources with a single vkQueueBindSparse, completion is tracked with a timeline semaphore
+    struct SparseBinder : Resource
+    {
+        // the binds are done once the semaphore reaches value
+        struct Ticket { uint64_t value = 0; };
+
+        EVK_API SparseBinder() : Resource{ nullptr }, queue{ nullptr }, semaphore{ nullptr } {}
+        // the family has to support eSparseBinding
+        EVK_API SparseBinder(const evk::SharedPtr<Device>& device, Device::QueueFamily queueFamily, Device::QueueCount queueIndex = 0);
+        EVK_API SparseBinder(const SparseBinder&) = delete;
+        EVK_API SparseBinder& operator=(const SparseBinder&) = delete;
+        EVK_API ~SparseBinder();
+
+        // waits for the (semaphore, value) pairs first, e.g. the work still reading pages that get unbound
+        EVK_API Ticket commit(
+            std::span<SparseBuffer* const> buffers,
+            std::span<SparseImage* const> images,
+            std::span<const std::pair<vk::Semaphore, uint64_t>> waits = {}
+        );
+        [[nodiscard]] EVK_API bool isComplete(Ticket ticket) const;
+        EVK_API bool wait(Ticket ticket, uint64_t timeout = UINT64_MAX) const;
+        // wait dependency for a submit2 that uses the newly bound memory
+        [[nodiscard]] EVK_API vk::SemaphoreSubmitInfo waitInfo(const Ticket ticket, const vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eAllCommands) const
+        {
+            return { *semaphore, ticket.value, stage };
+        }
+
+        const Queue* queue;
+        vk::raii::Semaphore semaphore;
+        uint64_t _nextValue = 1;
+        std::deque<std::pair<uint64_t, std::vector<evk::Allocation>>> _garbage; // unbound pages per commit, freed once it completes
+    };
+}
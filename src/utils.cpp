@@ -4,6 +4,9 @@ module;
 #include <optional>
 #include <functional>
 #include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 module evk;
 import :utils;
 using namespace evk;
@@ -107,15 +110,58 @@ std::optional<uint32_t> utils::findQueueFamilyIndex(
     return bestFamily;
 }
 
+utils::QueueFamilies utils::findQueueFamilies(
+    const std::vector<vk::QueueFamilyProperties>& queueFamiliesProperties,
+    const std::vector<uint32_t>& ignoreFamilies)
+{
+    QueueFamilies families;
+    auto ignore = ignoreFamilies;
+    families.graphics = findQueueFamilyIndex(queueFamiliesProperties, vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, ignore);
+    if (!families.graphics) families.graphics = findQueueFamilyIndex(queueFamiliesProperties, vk::QueueFlagBits::eGraphics, ignore);
+    if (families.graphics) ignore.push_back(*families.graphics);
+
+    families.compute = findQueueFamilyIndex(queueFamiliesProperties, vk::QueueFlagBits::eCompute, ignore);
+    if (families.compute) ignore.push_back(*families.compute);
+    else if (families.graphics && queueFamiliesProperties[*families.graphics].queueFlags & vk::QueueFlagBits::eCompute) families.compute = families.graphics;
+
+    // graphics and compute families support transfers without reporting it
+    families.transfer = findQueueFamilyIndex(queueFamiliesProperties, vk::QueueFlagBits::eTransfer, ignore);
+    if (!families.transfer) families.transfer = families.compute ? families.compute : families.graphics;
+    return families;
+}
+
+std::optional<uint32_t> utils::findMemoryTypeIndex(
+    const vk::PhysicalDeviceMemoryProperties& memoryProperties,
+    const vk::MemoryRequirements& requirements,
+    const MemoryTypeRequest& request)
+{
+    const auto count = [](const vk::MemoryPropertyFlags flags) { return static_cast<int>(std::bitset<32>{ static_cast<uint32_t>(flags) }.count()); };
+    std::optional<uint32_t> best;
+    int bestScore = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        const vk::MemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+        if (!(requirements.memoryTypeBits & (1u << i)) || (flags & request.required) != request.required) continue;
+        if ((flags & vk::MemoryPropertyFlagBits::eProtected) && !(request.required & vk::MemoryPropertyFlagBits::eProtected)) continue;
+        if (memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size < requirements.size) continue;
+        // HostCoherent and HostCached are not penalized when nobody asked for them, a readback should not end up on an
+        // uncached type because the cached one carries an extra flag
+        const vk::MemoryPropertyFlags neutral = request.required | request.preferred | request.avoided | vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached;
+        const int score = 4 * count(flags & request.preferred) - 4 * count(flags & request.avoided) - count(flags & ~neutral);
+        // equal scores keep the driver's order, which lists the faster types first
+        if (!best || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
 std::optional<uint32_t> utils::findMemoryTypeIndex(
     const vk::PhysicalDeviceMemoryProperties& memoryProperties, 
     const vk::MemoryRequirements& requirements, 
     const vk::MemoryPropertyFlags propertyFlags)
 {
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-        if ((requirements.memoryTypeBits & (1u << i)) && ((memoryProperties.memoryTypes[i].propertyFlags & propertyFlags) == propertyFlags)) return i;
-    }
-    return std::nullopt;
+    return findMemoryTypeIndex(memoryProperties, requirements, MemoryTypeRequest{ propertyFlags, {}, {} });
 }
 
 vk::ImageType utils::extentToImageType(const vk::Extent3D& extent)
@@ -148,3 +194,71 @@ vk::ImageAspectFlags utils::formatToAspectMask(const vk::Format format)
 	        return vk::ImageAspectFlagBits::eColor;
     }
 }
+
+bool utils::isBlockCompressed(const vk::Format format)
+{
+    const auto extent = vk::blockExtent(format);
+    return extent[0] > 1u || extent[1] > 1u || extent[2] > 1u;
+}
+
+vk::DeviceSize utils::imageByteSize(const vk::Extent3D& extent, const vk::Format format)
+{
+    const auto blockExtent = vk::blockExtent(format);
+    return vk::blockSize(format) *
+        (roundUpToMultipleOf<vk::DeviceSize>(std::max(extent.width, 1u), blockExtent[0]) / blockExtent[0]) *
+        (roundUpToMultipleOf<vk::DeviceSize>(std::max(extent.height, 1u), blockExtent[1]) / blockExtent[1]) *
+        (roundUpToMultipleOf<vk::DeviceSize>(std::max(extent.depth, 1u), blockExtent[2]) / blockExtent[2]);
+}
+
+utils::ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    _threads.reserve(threadCount - 1u);
+    for (uint32_t i = 1; i < threadCount; i++) _threads.emplace_back([this] { _work(); });
+}
+
+utils::ThreadPool::~ThreadPool()
+{
+    {
+        std::scoped_lock lock{ _mutex };
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) thread.join();
+}
+
+void utils::ThreadPool::parallelFor(const uint32_t count, const std::function<void(uint32_t)>& job)
+{
+    if (count == 0) return;
+    std::scoped_lock call{ _callMutex };
+    std::unique_lock lock{ _mutex };
+    _job = &job;
+    _next = 0;
+    _count = count;
+    _finished = 0;
+    _wake.notify_all();
+    while (_next < _count) {
+        const uint32_t i = _next++;
+        lock.unlock();
+        job(i);
+        lock.lock();
+        _finished++;
+    }
+    _done.wait(lock, [this] { return _finished == _count; });
+    _job = nullptr;
+}
+
+void utils::ThreadPool::_work()
+{
+    std::unique_lock lock{ _mutex };
+    while (true) {
+        _wake.wait(lock, [this] { return _stop || (_job && _next < _count); });
+        if (_stop) return;
+        const uint32_t i = _next++;
+        const auto* job = _job;
+        lock.unlock();
+        (*job)(i);
+        lock.lock();
+        if (++_finished == _count) _done.notify_all();
+    }
+}
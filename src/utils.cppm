@@ -4,6 +4,10 @@ module;
 #include <vector>
 #include <concepts>
 #include <functional>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -88,6 +92,36 @@ export namespace evk {
             vk::QueueFlags queueFlags,
             const std::vector<uint32_t>& ignoreFamilies = {}
         );
+        // one family per role, each the one with the fewest other capabilities that no earlier role took. Without a family of its
+        // own a role shares the previous one (compute runs on graphics, transfer on compute) or stays empty
+        struct QueueFamilies
+        {
+            std::optional<uint32_t> graphics; // graphics and compute
+            std::optional<uint32_t> compute; // async compute
+            std::optional<uint32_t> transfer; // dma
+        };
+        [[nodiscard]] EVK_API QueueFamilies findQueueFamilies(
+            const std::vector<vk::QueueFamilyProperties>& queueFamiliesProperties,
+            const std::vector<uint32_t>& ignoreFamilies = {}
+        );
+        // a type must have all required flags, among those the one with the most preferred and fewest avoided flags wins,
+        // other flags that were not asked for (e.g. HostVisible on a bar type) count as slightly avoided, except HostCoherent
+        // and HostCached which are harmless
+        struct MemoryTypeRequest
+        {
+            vk::MemoryPropertyFlags required;
+            vk::MemoryPropertyFlags preferred;
+            vk::MemoryPropertyFlags avoided;
+        };
+        // device results read by the host: cached reads are many times faster than reads from write-combined memory
+        inline constexpr MemoryTypeRequest readbackMemory{
+            vk::MemoryPropertyFlagBits::eHostVisible, vk::MemoryPropertyFlagBits::eHostCached, vk::MemoryPropertyFlagBits::eDeviceLocal
+        };
+        [[nodiscard]] EVK_API std::optional<uint32_t> findMemoryTypeIndex(
+            const vk::PhysicalDeviceMemoryProperties& memoryProperties,
+            const vk::MemoryRequirements& requirements,
+            const MemoryTypeRequest& request
+        );
         [[nodiscard]] EVK_API std::optional<uint32_t> findMemoryTypeIndex(
             const vk::PhysicalDeviceMemoryProperties& memoryProperties,
             const vk::MemoryRequirements& requirements,
@@ -103,6 +137,37 @@ export namespace evk {
         EVK_API vk::ImageAspectFlags formatToAspectMask(
             vk::Format format
         );
+        // BCn/ETC2/ASTC, copies and pitches are counted in whole blocks
+        EVK_API bool isBlockCompressed(
+            vk::Format format
+        );
+        // partial blocks at the right and bottom edge count as whole blocks
+        EVK_API vk::DeviceSize imageByteSize(
+            const vk::Extent3D& extent,
+            vk::Format format
+        );
+
+        // Fixed set of worker threads, the calling thread helps out until every index of a parallelFor ran
+        struct ThreadPool
+        {
+            EVK_API explicit ThreadPool(uint32_t threadCount = 0); // 0 for one thread per hardware thread (including the caller)
+            EVK_API ThreadPool(const ThreadPool&) = delete;
+            EVK_API ThreadPool& operator=(const ThreadPool&) = delete;
+            EVK_API ~ThreadPool();
+
+            // job(i) for every i in [0, count), blocks until all are done. Calls from several threads run one after another
+            EVK_API void parallelFor(uint32_t count, const std::function<void(uint32_t)>& job);
+            [[nodiscard]] EVK_API uint32_t threadCount() const { return static_cast<uint32_t>(_threads.size()) + 1u; }
+
+            void _work();
+
+            std::vector<std::thread> _threads;
+            std::mutex _callMutex, _mutex;
+            std::condition_variable _wake, _done;
+            const std::function<void(uint32_t)>* _job = nullptr;
+            uint32_t _next = 0, _count = 0, _finished = 0;
+            bool _stop = false;
+        };
 
         EVK_API const uint32_t& clampSwapchainImageCount(const uint32_t& count, const vk::SurfaceCapabilitiesKHR& capabilities)
         {